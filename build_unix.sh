@@ -23,3 +23,14 @@ cd cppred
 cmake .
 make -j $cpu_count
 cd ..
+
+# Build tools
+cd tools/frame_hash_diff
+cmake .
+make -j $cpu_count
+cd ../..
+
+cd tools/audio_benchmark
+cmake .
+make -j $cpu_count
+cd ../..
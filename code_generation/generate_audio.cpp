@@ -1,7 +1,7 @@
 #include "generate_audio.h"
 #include "../FreeImage/Source/ZLib/zlib.h"
 #include "../common/calculate_frequency.h"
-#include "../common/AudioCommandType.h"
+#include "../common/AudioBytecode.h"
 #include "../common/AudioResourceType.h"
 #include <iostream>
 #include <memory>
@@ -18,6 +18,18 @@ static const char * const hash_key = "generate_audio";
 static const char * const date_string = __DATE__ __TIME__;
 static const u32 invalid_u32 = std::numeric_limits<u32>::max();
 
+static byte_t to_byte_operand(u32 value){
+	if (value > std::numeric_limits<byte_t>::max())
+		throw std::runtime_error("Audio command parameter out of range: " + std::to_string(value));
+	return (byte_t)value;
+}
+
+static std::uint16_t to_word_operand(u32 value){
+	if (value > std::numeric_limits<std::uint16_t>::max())
+		throw std::runtime_error("Audio command parameter out of range: " + std::to_string(value));
+	return (std::uint16_t)value;
+}
+
 class AudioCommand{
 protected:
 	u32 params[4];
@@ -50,10 +62,112 @@ public:
 	void set_dst(u32 dst){
 		this->params[this->parameter_count - 1] = dst;
 	}
-	void serialize(std::vector<std::uint8_t> &sequences){
-		write_varint(sequences, this->command_id());
-		for (int i = 0; i < this->parameter_count; i++)
-			write_varint(sequences, this->params[i]);
+	//Not valid for IfRed, Else, or EndIf, which only make sense in the
+	//context of their sequence.
+	AudioInstruction encode() const{
+		AudioInstruction ret = {};
+		auto &p = this->params;
+		switch ((AudioCommandType)this->command_id()){
+			case AudioCommandType::Tempo:
+				ret.opcode = AudioOpcode::Tempo;
+				ret.word = to_word_operand(p[0]);
+				break;
+			case AudioCommandType::Volume:
+				ret.opcode = AudioOpcode::Volume;
+				ret.a = (byte_t)((p[0] & 0x0F) | ((p[1] & 0x0F) << 4));
+				break;
+			case AudioCommandType::Duty:
+				ret.opcode = AudioOpcode::Duty;
+				ret.a = to_byte_operand(p[0]);
+				break;
+			case AudioCommandType::DutyCycle:
+				ret.opcode = AudioOpcode::DutyCycle;
+				ret.a = to_byte_operand(p[0]);
+				break;
+			case AudioCommandType::Vibrato:
+				{
+					ret.opcode = AudioOpcode::Vibrato;
+					ret.a = to_byte_operand(p[0]);
+					ret.b = to_byte_operand(p[2]);
+					auto extent = p[1] / 2;
+					extent += (extent + p[1] % 2) << 4;
+					ret.word = to_word_operand(extent);
+				}
+				break;
+			case AudioCommandType::TogglePerfectPitch:
+				ret.opcode = AudioOpcode::TogglePerfectPitch;
+				break;
+			case AudioCommandType::NoteType:
+				ret.opcode = AudioOpcode::NoteType;
+				ret.a = to_byte_operand(p[0]);
+				ret.b = to_byte_operand(p[1]);
+				ret.c = to_byte_operand(p[2]);
+				break;
+			case AudioCommandType::Rest:
+				ret.opcode = AudioOpcode::Rest;
+				ret.a = to_byte_operand(p[0]);
+				break;
+			case AudioCommandType::Octave:
+				ret.opcode = AudioOpcode::Octave;
+				ret.a = to_byte_operand(p[0]);
+				break;
+			case AudioCommandType::Note:
+				ret.opcode = AudioOpcode::Note;
+				ret.a = to_byte_operand(p[0]);
+				ret.b = to_byte_operand(p[1]);
+				break;
+			case AudioCommandType::DSpeed:
+				ret.opcode = AudioOpcode::DSpeed;
+				ret.a = to_byte_operand(p[0]);
+				break;
+			case AudioCommandType::NoiseInstrument:
+				ret.opcode = AudioOpcode::NoiseInstrument;
+				ret.a = to_byte_operand(p[0]);
+				ret.b = to_byte_operand(p[1]);
+				break;
+			case AudioCommandType::UnknownSfx10:
+				ret.opcode = AudioOpcode::UnknownSfx10;
+				ret.a = to_byte_operand(p[0]);
+				break;
+			case AudioCommandType::UnknownSfx20:
+			case AudioCommandType::UnknownNoise20:
+				ret.opcode = (AudioCommandType)this->command_id() == AudioCommandType::UnknownSfx20 ? AudioOpcode::UnknownSfx20 : AudioOpcode::UnknownNoise20;
+				ret.a = to_byte_operand(p[0]);
+				ret.b = to_byte_operand(p[1]);
+				ret.word = to_word_operand(p[2]);
+				break;
+			case AudioCommandType::ExecuteMusic:
+				ret.opcode = AudioOpcode::ExecuteMusic;
+				break;
+			case AudioCommandType::PitchBend:
+				ret.opcode = AudioOpcode::PitchBend;
+				ret.a = to_byte_operand(p[0]);
+				ret.word = to_word_operand(p[1]);
+				break;
+			case AudioCommandType::StereoPanning:
+				ret.opcode = AudioOpcode::StereoPanning;
+				ret.a = to_byte_operand(p[0]);
+				break;
+			case AudioCommandType::Loop:
+				ret.opcode = AudioOpcode::Loop;
+				ret.a = to_byte_operand(p[0]);
+				ret.word = to_word_operand(p[1]);
+				break;
+			case AudioCommandType::Call:
+				ret.opcode = AudioOpcode::Call;
+				ret.word = to_word_operand(p[0]);
+				break;
+			case AudioCommandType::Goto:
+				ret.opcode = AudioOpcode::Goto;
+				ret.word = to_word_operand(p[0]);
+				break;
+			case AudioCommandType::End:
+				ret.opcode = AudioOpcode::End;
+				break;
+			default:
+				throw std::runtime_error("AudioCommand::encode(): Invalid command.");
+		}
+		return ret;
 	}
 };
 
@@ -74,9 +188,16 @@ public:
 			throw std::runtime_error("Numerical limits exceeded.");
 		return (u32)this->commands.size();
 	}
+	//EndIf doesn't generate an instruction.
+	u32 instruction_count() const{
+		u32 ret = 0;
+		for (auto &c : this->commands)
+			ret += (AudioCommandType)c->command_id() != AudioCommandType::EndIf;
+		return ret;
+	}
 	void set_location(u32 &n){
 		this->location = n;
-		n += this->commands.size();
+		n += this->instruction_count();
 	}
 	u32 get_location() const{
 		return this->location;
@@ -97,10 +218,38 @@ public:
 	const std::vector<std::unique_ptr<AudioCommand>> &get_commands() const{
 		return this->commands;
 	}
-	void serialize(std::vector<std::uint8_t> &sequences){
-		//write_varint(sequences, (u32)this->commands.size());
-		for (auto &c : this->commands)
-			c->serialize(sequences);
+	//Appends the instructions of the sequence to program, which must end at
+	//the location of the sequence. ifred blocks are lowered to jumps: IfRed
+	//jumps past its block in any other version, and Else jumps past EndIf.
+	void encode(std::vector<AudioInstruction> &program) const{
+		assert(program.size() == this->location);
+		std::vector<size_t> pending_jumps;
+		for (auto &c : this->commands){
+			switch ((AudioCommandType)c->command_id()){
+				case AudioCommandType::IfRed:
+					pending_jumps.push_back(program.size());
+					program.push_back({ AudioOpcode::JumpUnlessRed });
+					break;
+				case AudioCommandType::Else:
+					if (!pending_jumps.size())
+						throw std::runtime_error("Error: else without ifred in sequence " + this->name);
+					program[pending_jumps.back()].word = to_word_operand((u32)program.size() + 1);
+					pending_jumps.back() = program.size();
+					program.push_back({ AudioOpcode::Goto });
+					break;
+				case AudioCommandType::EndIf:
+					if (!pending_jumps.size())
+						throw std::runtime_error("Error: endif without ifred in sequence " + this->name);
+					program[pending_jumps.back()].word = to_word_operand((u32)program.size());
+					pending_jumps.pop_back();
+					break;
+				default:
+					program.push_back(c->encode());
+					break;
+			}
+		}
+		if (pending_jumps.size())
+			throw std::runtime_error("Error: ifred without endif in sequence " + this->name);
 	}
 };
 
@@ -667,13 +816,13 @@ public:
 		this->remove_unreachable_sequences(log_file);
 		this->place_sequences();
 	}
-	void serialize_sequences(std::vector<std::uint8_t> &sequences) const{
-		u32 command_count = 0;
-		for (auto &s : this->sequences)
-			command_count += (u32)s.second->get_commands().size();
-		write_varint(sequences, command_count);
+	std::vector<AudioInstruction> encode_program() const{
+		std::vector<AudioInstruction> ret;
 		for (auto &s : this->sequences)
-			s.second->serialize(sequences);
+			s.second->encode(ret);
+		//Sentinel, in case the last sequence doesn't end.
+		ret.push_back({ AudioOpcode::End });
+		return ret;
 	}
 	void serialize_headers(std::vector<std::uint8_t> &headers) const{
 		write_varint(headers, (u32)this->headers.size());
@@ -691,9 +840,29 @@ public:
 	}
 };
 
+static const char *to_string(AudioOpcode opcode){
+#define AUDIO_OPCODE_STRING(x) #x,
+	static const char * const strings[] = {
+		AUDIO_OPCODES(AUDIO_OPCODE_STRING)
+	};
+#undef AUDIO_OPCODE_STRING
+	assert((size_t)opcode < sizeof(strings) / sizeof(*strings));
+	return strings[(size_t)opcode];
+}
+
+static void write_program(const char *path, const AudioData &data){
+	auto program = data.encode_program();
+	std::ofstream source(path);
+	source << generated_file_warning <<
+		"\n"
+		"constexpr AudioInstruction audio_program[] = {\n";
+	for (auto &i : program)
+		source << "    { AudioOpcode::" << to_string(i.opcode) << ", " << (int)i.a << ", " << (int)i.b << ", " << (int)i.c << ", " << i.word << " },\n";
+	source << "};\n";
+}
+
 static void write_header_and_source(const char *header_path, const char *source_path, const std::vector<AudioHeader> &headers, const AudioData &data){
-	std::vector<std::uint8_t> sequences, serialized_headers;
-	data.serialize_sequences(sequences);
+	std::vector<std::uint8_t> serialized_headers;
 	data.serialize_headers(serialized_headers);
 
 	{
@@ -701,8 +870,6 @@ static void write_header_and_source(const char *header_path, const char *source_
 		header << "#pragma once\n"
 			<< generated_file_warning <<
 			"\n"
-			"extern const byte_t audio_sequence_data[];\n"
-			"static const size_t audio_sequence_data_size = " << sequences.size() << ";\n"
 			"extern const byte_t audio_header_data[];\n"
 			"static const size_t audio_header_data_size = " << serialized_headers.size() << ";\n"
 			"enum class AudioResourceId{\n"
@@ -717,9 +884,6 @@ static void write_header_and_source(const char *header_path, const char *source_
 		std::ofstream source(source_path);
 		source << generated_file_warning <<
 			"\n"
-			"extern const byte_t audio_sequence_data[] = ";
-		write_buffer_to_stream(source, sequences);
-		source << std::dec << ";\n"
 			"extern const byte_t audio_header_data[] = ";
 		write_buffer_to_stream(source, serialized_headers);
 		source << std::dec << ";\n";
@@ -738,6 +902,7 @@ static void generate_audio_internal(known_hashes_t &known_hashes){
 	AudioData data(log_file);
 
 	write_header_and_source("output/audio.h", "output/audio.inl", data.get_headers(), data);
+	write_program("output/audio_program.inl", data);
 
 	known_hashes[hash_key] = current_hash;
 }
@@ -0,0 +1,47 @@
+#pragma once
+#include "AudioCommandType.h"
+
+//Opcodes of the decoded audio program. IfRed, Else, and EndIf don't exist at
+//this level; they are lowered to jumps by the code generator.
+#define AUDIO_OPCODES(X) \
+	X(Tempo)              /* word: tempo */                                   \
+	X(Volume)             /* a: value for NR50 */                             \
+	X(Duty)               /* a: duty, already shifted into bits 6-7 */        \
+	X(DutyCycle)          /* a: duty cycle */                                 \
+	X(Vibrato)            /* a: delay, b: depth, word: extent */              \
+	X(TogglePerfectPitch)                                                     \
+	X(NoteType)           /* a: speed, b: volume, c: fade */                  \
+	X(Rest)               /* a: length */                                     \
+	X(Octave)             /* a: octave, already inverted */                   \
+	X(Note)               /* a: pitch, b: length */                           \
+	X(DSpeed)             /* a: speed */                                      \
+	X(NoiseInstrument)    /* a: pitch, b: length */                           \
+	X(UnknownSfx10)       /* a: value for NR10 */                             \
+	X(UnknownSfx20)       /* a: length, b: envelope, word: frequency */       \
+	X(UnknownNoise20)     /* a: length, b: envelope, word: frequency */       \
+	X(ExecuteMusic)                                                           \
+	X(PitchBend)          /* a: length, word: target frequency */             \
+	X(StereoPanning)      /* a: panning */                                    \
+	X(Loop)               /* a: times, word: destination */                   \
+	X(Call)               /* word: destination */                             \
+	X(Goto)               /* word: destination */                             \
+	X(JumpUnlessRed)      /* word: destination */                             \
+	X(End)
+
+#define AUDIO_OPCODE_ENUM_ITEM(x) x,
+
+enum class AudioOpcode : byte_t{
+	AUDIO_OPCODES(AUDIO_OPCODE_ENUM_ITEM)
+};
+
+#undef AUDIO_OPCODE_ENUM_ITEM
+
+//A single audio command, with its operands already decoded and stored at
+//their natural widths. Destinations are indices into the program.
+struct AudioInstruction{
+	AudioOpcode opcode;
+	byte_t a;
+	byte_t b;
+	byte_t c;
+	std::uint16_t word;
+};
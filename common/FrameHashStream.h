@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+//A frame hash stream is a binary file with a 64-bit hash for every frame
+//rendered by the game, used to compare runs without storing the frames
+//themselves. Layout, with every integer stored in little endian:
+//
+//    8 bytes: frame_hash_stream_magic
+//    u32:     width of the frames, in pixels
+//    u32:     height of the frames, in pixels
+//    u64:     hash of frame 0
+//    u64:     hash of frame 1
+//    ...
+
+static const char frame_hash_stream_magic[8] = { 'C', 'R', 'F', 'H', 'A', 'S', 'H', '1' };
+static const size_t frame_hash_stream_header_size = 16;
+
+inline void write_le(std::uint8_t *dst, std::uint64_t value, int bytes){
+	for (int i = 0; i < bytes; i++)
+		dst[i] = (std::uint8_t)(value >> (i * 8));
+}
+
+inline std::uint64_t read_le(const std::uint8_t *src, int bytes){
+	std::uint64_t ret = 0;
+	for (int i = bytes; i--;)
+		ret = (ret << 8) | src[i];
+	return ret;
+}
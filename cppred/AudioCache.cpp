@@ -0,0 +1,129 @@
+#include "AudioCache.h"
+#include "AudioDevice.h"
+#include "HeliosRenderer.h"
+#include "CppRed/AudioProgram.h"
+#include "threads.h"
+#include "../CodeGeneration/output/audio.h"
+#include <algorithm>
+
+//SFX still playing after this long (e.g. because they loop), or that haven't
+//left the renderer silent by then (e.g. because a channel was left holding a
+//tone), aren't cached.
+static const double max_duration = 10;
+//The program is stepped by the renderer, so the step doesn't affect the
+//output.
+static const double render_step = 0.01;
+
+namespace{
+
+//Starts the SFX at the first tick, exactly as an AudioCommand would, and
+//records where in the output it started and for how many ticks it played.
+class StartingSequencer : public AudioSequencer{
+	CppRed::AudioProgram *program;
+	HeliosRenderer *renderer;
+	AudioResourceId id;
+	bool started = false;
+	bool finished = false;
+	std::uint64_t start = 0;
+	unsigned ticks = 0;
+public:
+	StartingSequencer(CppRed::AudioProgram &program, HeliosRenderer &renderer, AudioResourceId id): program(&program), renderer(&renderer), id(id){}
+	void sequencer_tick(double time) override{
+		if (!this->started){
+			this->start = this->renderer->get_synthesis_position();
+			auto lock = this->program->acquire_lock();
+			this->program->play_sound(this->id);
+			this->started = true;
+		}
+		this->program->sequencer_tick(time);
+		if (!this->finished){
+			this->ticks++;
+			this->finished = !this->program->get_playing();
+		}
+	}
+	bool get_finished() const{
+		return this->finished;
+	}
+	std::uint64_t get_start() const{
+		return this->start;
+	}
+	unsigned get_ticks() const{
+		return this->ticks;
+	}
+};
+
+}
+
+AudioCache::AudioCache(PokemonVersion version): version(version){
+	this->entries.resize((size_t)AudioResourceId::Stop);
+	this->rendered = 0;
+	this->continue_running = true;
+	this->thread.reset(new std::thread([this](){ this->render_all(); }));
+}
+
+AudioCache::~AudioCache(){
+	this->continue_running = false;
+	join_thread(this->thread);
+}
+
+void AudioCache::render_all(){
+	try{
+		//Resource 0 is None.
+		for (size_t i = 1; i < this->entries.size() && this->continue_running; i++){
+			auto &entry = this->entries[i];
+			entry.valid = this->render((AudioResourceId)i, entry);
+			this->rendered = i + 1;
+		}
+	}catch (std::exception &){
+		//Whatever wasn't rendered is synthesized as usual.
+	}
+}
+
+bool AudioCache::render(AudioResourceId id, Entry &entry){
+	AudioDevice device(true);
+	HeliosRenderer renderer(device);
+	CppRed::AudioProgram program(renderer, this->version);
+	auto type = program.get_resource_type(id);
+	if (type != AudioResourceType::Sfx && type != AudioResourceType::Cry)
+		return false;
+	std::vector<StereoSampleFinal> output;
+	renderer.set_capture(&output);
+	//Same state that AudioScheduler starts from.
+	renderer.set_NR52(0xFF);
+	renderer.set_NR50(0x77);
+	StartingSequencer sequencer(program, renderer, id);
+	renderer.set_sequencer(&sequencer);
+	bool silent = false;
+	std::uint64_t silent_at = 0;
+	bool done = false;
+	for (double t = 0; t < max_duration && this->continue_running && !done; t += render_step){
+		renderer.update(t);
+		if (!silent && sequencer.get_finished() && renderer.is_silent()){
+			silent = true;
+			silent_at = renderer.get_synthesis_position();
+		}
+		//Only whole frames are captured, so the output may still be behind
+		//the point where the renderer went silent for a while.
+		done = silent && output.size() >= silent_at;
+	}
+	renderer.set_sequencer(nullptr);
+	renderer.set_capture(nullptr);
+	if (!done)
+		return false;
+
+	auto begin = std::min<size_t>((size_t)sequencer.get_start(), (size_t)silent_at);
+	auto end = (size_t)silent_at;
+	while (end > begin && !output[end - 1].left && !output[end - 1].right)
+		end--;
+	entry.samples.assign(output.begin() + begin, output.begin() + end);
+	entry.ticks = sequencer.get_ticks();
+	return true;
+}
+
+const AudioCache::Entry *AudioCache::get(AudioResourceId id) const{
+	auto i = (size_t)id;
+	if (i >= this->rendered)
+		return nullptr;
+	auto &entry = this->entries[i];
+	return entry.valid ? &entry : nullptr;
+}
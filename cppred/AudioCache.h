@@ -0,0 +1,49 @@
+#pragma once
+#include "AudioData.h"
+#include "pokemon_version.h"
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+enum class AudioResourceId;
+
+//PCM of every SFX and cry, rendered once by the regular AudioProgram and
+//HeliosRenderer, starting from silence. AudioProgram mixes these instead of
+//synthesizing an SFX when the renderer is silent (see
+//AudioProgram::set_cache()). Only sounds that leave the renderer silent again
+//are cached, so that whatever plays next starts from the same state either
+//way. The entries are rendered by a background thread, in order, and become
+//available as they're finished.
+class AudioCache{
+public:
+	struct Entry{
+		//At synthesis_frequency, from the tick that starts the sound, up to
+		//the last sample that isn't 0.
+		std::vector<StereoSampleFinal> samples;
+		//Sequencer ticks, including the first one, until the sound ends.
+		unsigned ticks = 0;
+		bool valid = false;
+	};
+private:
+	PokemonVersion version;
+	std::vector<Entry> entries;
+	//Entries before this index are final.
+	std::atomic<size_t> rendered;
+	std::atomic<bool> continue_running;
+	std::unique_ptr<std::thread> thread;
+
+	void render_all();
+	bool render(AudioResourceId, Entry &);
+public:
+	AudioCache(PokemonVersion);
+	~AudioCache();
+	AudioCache(const AudioCache &) = delete;
+	void operator=(const AudioCache &) = delete;
+	PokemonVersion get_version() const{
+		return this->version;
+	}
+	//Returns nullptr if the resource can't be cached or hasn't been rendered
+	//yet. Never blocks.
+	const Entry *get(AudioResourceId) const;
+};
@@ -3,7 +3,21 @@
 
 static const unsigned gb_cpu_frequency_power = 22;
 static const unsigned gb_cpu_frequency = 1 << gb_cpu_frequency_power;
-static const unsigned sampling_frequency = 44100;
+//CPU cycles between sequencer updates (one DMG display frame).
+static const unsigned sequencer_period = 70224;
+
+//Stepped by the renderer every sequencer_period cycles of synthesis time, so
+//that the register writes it makes land at exact sample positions.
+class AudioSequencer{
+public:
+	virtual ~AudioSequencer(){}
+	//time is the tick's position in the timeline passed to the renderer's
+	//update().
+	virtual void sequencer_tick(double time) = 0;
+};
+//Rate at which the channels are sampled. The output is resampled to the rate
+//of the device if it differs (see Resampler.h).
+static const unsigned synthesis_frequency = 44100;
 
 template <typename T>
 struct basic_StereoSample{
@@ -60,6 +74,9 @@ struct basic_StereoSample{
 
 //#define USE_FLOAT_AUDIO
 //#define USE_STD_FUNCTION
+//Render the channels as band-limited steps (see BlepBuffer.h) instead of
+//point-sampling them.
+//#define USE_BAND_LIMITED_SYNTHESIS
 
 #ifdef USE_FLOAT_AUDIO
 typedef float intermediate_audio_type;
@@ -72,7 +89,28 @@ typedef basic_StereoSample<intermediate_audio_type> StereoSampleIntermediate;
 basic_StereoSample<std::int16_t> convert(const basic_StereoSample<intermediate_audio_type> &);
 
 struct AudioFrame{
-	static const unsigned length = 1024;
+	//Capacity of buffer. Only the first length samples are used.
+	static const unsigned max_length = 8192;
 	std::uint64_t frame_no;
-	StereoSampleFinal buffer[length];
+	unsigned length;
+	//Time at which the frame was queued, in seconds.
+	double publish_time;
+	StereoSampleFinal buffer[max_length];
+};
+
+struct AudioBufferOptions{
+	//Samples per AudioFrame. Also requested as the device buffer size, but the
+	//device may grant a different one.
+	unsigned frame_length = 1024;
+	//Maximum number of frames queued between the renderer and the device.
+	//Frames rendered while the queue is full are dropped.
+	unsigned queue_depth = 15;
+	//In pull-driven mode, number of frames rendered ahead of the device.
+	unsigned latency_frames = 2;
+	//Output sample rate. If 0, the device picks it.
+	unsigned frequency = 0;
+
+	double get_frame_duration(unsigned frequency) const{
+		return (double)this->frame_length / frequency;
+	}
 };
@@ -1,30 +1,45 @@
 #include "AudioDevice.h"
 #include "AudioData.h"
 #include "utility.h"
+#include <algorithm>
 
-bool operator==(const SDL_AudioSpec &a, const SDL_AudioSpec &b){
+//Neither the buffer size nor the frequency are compared, since AudioRenderer
+//can feed buffers of any size and HeliosRenderer resamples to any frequency.
+static bool same_format(const SDL_AudioSpec &a, const SDL_AudioSpec &b){
 	return
-		a.freq == b.freq &&
 		a.format == b.format &&
-		a.channels == b.channels &&
-		a.samples == b.samples;
+		a.channels == b.channels;
 }
 
-AudioDevice::AudioDevice(){
+AudioDevice::AudioDevice(bool headless, const AudioBufferOptions &options){
+	this->renderer = nullptr;
+	this->frequency = options.frequency ? options.frequency : synthesis_frequency;
+	//A headless device never opens the sound card. Renderers may still be
+	//attached to it, but nothing will ever pull frames from them.
+	if (headless)
+		return;
 	SDL_AudioSpec desired, actual;
 	memset(&desired, 0, sizeof(desired));
-	desired.freq = sampling_frequency;
+	desired.freq = this->frequency;
 	desired.format = AUDIO_S16SYS;
 	desired.channels = 2;
-	desired.samples = AudioFrame::length;
+	desired.samples = (Uint16)std::min<unsigned>(options.frame_length, 0x8000);
 	desired.callback = audio_callback;
 	desired.userdata = this;
-	this->audio_device = SDL_OpenAudioDevice(nullptr, false, &desired, &actual, 0);
-	if (!(actual == desired)){
+	//Unless a frequency was requested, let the device use its native one
+	//rather than have SDL convert ours.
+	int allowed_changes = SDL_AUDIO_ALLOW_SAMPLES_CHANGE;
+	if (!options.frequency)
+		allowed_changes |= SDL_AUDIO_ALLOW_FREQUENCY_CHANGE;
+	this->audio_device = SDL_OpenAudioDevice(nullptr, false, &desired, &actual, allowed_changes);
+	if (!this->audio_device)
+		return;
+	if (!same_format(actual, desired)){
 		SDL_CloseAudioDevice(this->audio_device);
 		this->audio_device = 0;
 		return;
 	}
+	this->frequency = actual.freq;
 	SDL_PauseAudioDevice(this->audio_device, 0);
 }
 
@@ -38,30 +53,35 @@ AudioDevice::~AudioDevice(){
 
 void SDLCALL AudioDevice::audio_callback(void *userdata, Uint8 *stream, int len){
 	auto This = (AudioDevice *)userdata;
-	if (!This->renderer){
+	auto renderer = This->renderer.load();
+	if (!renderer){
 		memset(stream, 0, len);
 		return;
 	}
-	This->renderer->write_data_to_device(stream, len);
+	renderer->write_data_to_device(stream, len);
 }
 
 class AudioLock{
 	SDL_AudioDeviceID dev;
 public:
 	AudioLock(SDL_AudioDeviceID dev): dev(dev){
-		SDL_LockAudioDevice(this->dev);
+		if (this->dev)
+			SDL_LockAudioDevice(this->dev);
 	}
 	~AudioLock(){
-		SDL_UnlockAudioDevice(this->dev);
+		if (this->dev)
+			SDL_UnlockAudioDevice(this->dev);
 	}
 };
 
+//The callback never waits for another thread. It only picks up the new
+//renderer on its next run.
 void AudioDevice::set_renderer(AudioRenderer &renderer){
-	AudioLock al(this->audio_device);
 	this->renderer = &renderer;
 }
 
 void AudioDevice::clear_renderer(){
-	AudioLock al(this->audio_device);
 	this->renderer = nullptr;
+	//Wait for a callback that may still be using the old renderer.
+	AudioLock al(this->audio_device);
 }
@@ -1,14 +1,20 @@
 #pragma once
 #include "AudioRenderer.h"
 #include <SDL.h>
+#include <atomic>
 
 class AudioDevice{
 	SDL_AudioDeviceID audio_device = 0;
-	AudioRenderer *renderer = nullptr;
+	unsigned frequency;
+	std::atomic<AudioRenderer *> renderer;
 	static void SDLCALL audio_callback(void *userdata, Uint8 *stream, int len);
 public:
-	AudioDevice();
+	AudioDevice(bool headless = false, const AudioBufferOptions & = AudioBufferOptions());
 	~AudioDevice();
 	void set_renderer(AudioRenderer &);
 	void clear_renderer();
+	//Sample rate the renderers must output.
+	unsigned get_frequency() const{
+		return this->frequency;
+	}
 };
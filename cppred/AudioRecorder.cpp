@@ -0,0 +1,103 @@
+#include "AudioRecorder.h"
+#include <cstring>
+#include <stdexcept>
+
+static const unsigned wav_header_size = 44;
+
+static void write_le(std::uint8_t *dst, std::uint32_t value, int bytes){
+	for (int i = 0; i < bytes; i++)
+		dst[i] = (std::uint8_t)(value >> (i * 8));
+}
+
+static void make_wav_header(std::uint8_t (&header)[wav_header_size], std::uint64_t samples){
+	const unsigned channels = 2;
+	const unsigned bytes_per_sample = sizeof(StereoSampleFinal) / channels;
+	auto data_size = (std::uint32_t)(samples * sizeof(StereoSampleFinal));
+	memcpy(header, "RIFF", 4);
+	write_le(header + 4, data_size + wav_header_size - 8, 4);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	write_le(header + 16, 16, 4);
+	//PCM
+	write_le(header + 20, 1, 2);
+	write_le(header + 22, channels, 2);
+	write_le(header + 24, synthesis_frequency, 4);
+	write_le(header + 28, synthesis_frequency * sizeof(StereoSampleFinal), 4);
+	write_le(header + 32, sizeof(StereoSampleFinal), 2);
+	write_le(header + 34, bytes_per_sample * 8, 2);
+	memcpy(header + 36, "data", 4);
+	write_le(header + 40, data_size, 4);
+}
+
+WavWriter::WavWriter(const std::string &path): file(path, std::ios::binary){
+	if (!this->file)
+		throw std::runtime_error("Can't open WAV file: " + path);
+	std::uint8_t header[wav_header_size];
+	make_wav_header(header, 0);
+	this->file.write((const char *)header, sizeof(header));
+}
+
+WavWriter::~WavWriter(){
+	std::uint8_t header[wav_header_size];
+	make_wav_header(header, this->samples);
+	this->file.seekp(0);
+	this->file.write((const char *)header, sizeof(header));
+}
+
+void WavWriter::write(const StereoSampleFinal *samples, size_t count){
+	this->file.write((const char *)samples, count * sizeof(StereoSampleFinal));
+	this->samples += count;
+}
+
+static std::string stem_path(const std::string &path, int channel){
+	auto extension = path.rfind('.');
+	if (extension == path.npos || path.find_first_of("/\\", extension) != path.npos)
+		extension = path.size();
+	return path.substr(0, extension) + "-" + std::to_string(channel + 1) + path.substr(extension);
+}
+
+AudioRecorder::AudioRecorder(const std::string &path, bool stems, unsigned ring_size):
+		free_blocks(ring_size),
+		full_blocks(ring_size + 1){
+	this->mix_writer.reset(new WavWriter(path));
+	if (stems)
+		for (int i = 0; i < 4; i++)
+			this->stem_writers[i].reset(new WavWriter(stem_path(path, i)));
+	for (unsigned i = 0; i < ring_size; i++){
+		this->allocated.emplace_back(new Block);
+		this->free_blocks.enqueue(this->allocated.back().get());
+	}
+	this->thread.reset(new std::thread([this](){ this->writer(); }));
+}
+
+AudioRecorder::~AudioRecorder(){
+	//A null block tells the writer to stop.
+	this->full_blocks.enqueue(nullptr);
+	join_thread(this->thread);
+}
+
+void AudioRecorder::writer(){
+	while (true){
+		Block *block;
+		this->full_blocks.wait_dequeue(block);
+		if (!block)
+			break;
+		this->mix_writer->write(block->mix, block->length);
+		for (int i = 0; i < 4; i++)
+			if (this->stem_writers[i])
+				this->stem_writers[i]->write(block->channels[i], block->length);
+		this->free_blocks.enqueue(block);
+	}
+}
+
+AudioRecorder::Block *AudioRecorder::get_block(){
+	Block *ret;
+	this->free_blocks.wait_dequeue(ret);
+	ret->length = 0;
+	if (this->has_stems())
+		memset(ret->channels, 0, sizeof(ret->channels));
+	return ret;
+}
+
+void AudioRecorder::submit(Block *block){
+	this->full_blocks.enqueue(block);
+}
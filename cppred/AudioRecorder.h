@@ -0,0 +1,56 @@
+#pragma once
+
+#include "AudioData.h"
+#include "threads.h"
+#include "queue/readerwriterqueue.h"
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+//Writes 16-bit stereo PCM to a WAV file. The sizes in the header are filled in
+//when the writer is destroyed.
+class WavWriter{
+	std::ofstream file;
+	std::uint64_t samples = 0;
+public:
+	WavWriter(const std::string &path);
+	~WavWriter();
+	void write(const StereoSampleFinal *samples, size_t count);
+};
+
+//Saves the output of an AudioRenderer to WAV files. The renderer fills blocks
+//from a fixed ring, and a background thread writes them, so rendering never
+//waits on the disk unless the whole ring is full. No block is ever dropped.
+//Optionally, each channel is also saved to its own file (a stem), named after
+//the mix with the channel number appended.
+class AudioRecorder{
+public:
+	struct Block{
+		unsigned length;
+		StereoSampleFinal mix[AudioFrame::max_length];
+		StereoSampleFinal channels[4][AudioFrame::max_length];
+	};
+private:
+	std::unique_ptr<WavWriter> mix_writer;
+	std::unique_ptr<WavWriter> stem_writers[4];
+	std::vector<std::unique_ptr<Block>> allocated;
+	moodycamel::BlockingReaderWriterQueue<Block *> free_blocks;
+	moodycamel::BlockingReaderWriterQueue<Block *> full_blocks;
+	std::unique_ptr<std::thread> thread;
+
+	void writer();
+public:
+	AudioRecorder(const std::string &path, bool stems, unsigned ring_size = 16);
+	//Writes every submitted block before returning.
+	~AudioRecorder();
+	AudioRecorder(const AudioRecorder &) = delete;
+	void operator=(const AudioRecorder &) = delete;
+	bool has_stems() const{
+		return !!this->stem_writers[0];
+	}
+	//Returns an empty block, with its stems zeroed. Waits for the writer thread
+	//if the ring is full.
+	Block *get_block();
+	void submit(Block *);
+};
@@ -1,7 +1,8 @@
 #include "AudioRenderer.h"
 #include "AudioDevice.h"
+#include "threads.h"
 
-AudioRenderer::AudioRenderer(AudioDevice &device): device(&device){
+AudioRenderer::AudioRenderer(AudioDevice &device): demand_watermark(0), device(&device){
 	this->device->set_renderer(*this);
 }
 
@@ -9,23 +10,67 @@ AudioRenderer::~AudioRenderer(){
 	this->device->clear_renderer();
 }
 
-void AudioRenderer::write_data_to_device(Uint8 *stream, int len){
-	{
-		LOCK_MUTEX(this->mutex);
+unsigned AudioRenderer::get_output_frequency() const{
+	return this->device->get_frequency();
+}
+
+//Returns the next frame in sequence, discarding stale ones, or nullptr if none
+//is ready.
+AudioFrame *AudioRenderer::next_frame(){
+	while (true){
 		auto frame = this->get_current_frame();
-		if (frame){
-			if (frame->frame_no < this->expected_frame){
-				this->return_used_frame(frame);
-			}else{
-				this->expected_frame = frame->frame_no + 1;
-				auto n = std::min<size_t>(len, sizeof(frame->buffer));
-				memcpy(stream, frame->buffer, n);
-				if (len - n)
-					memset(stream + n, 0, len - n);
-				this->return_used_frame(frame);
-				return;
-			}
+		if (!frame)
+			return nullptr;
+		if (frame->frame_no >= this->expected_frame){
+			this->expected_frame = frame->frame_no + 1;
+			this->stats.record_latency(this->clock.get() - frame->publish_time);
+			return frame;
 		}
+		this->stats.record_late_frame();
+		this->return_used_frame(frame);
 	}
-	memset(stream, 0, len);
+}
+
+//The device may ask for any number of samples, regardless of the frame length,
+//so frames are consumed across callbacks as needed.
+void AudioRenderer::write_data_to_device(Uint8 *stream, int len){
+	auto dst = (StereoSampleFinal *)stream;
+	size_t samples = len / sizeof(StereoSampleFinal);
+	size_t written = 0;
+	auto queued = this->get_queued_frames();
+	while (written < samples){
+		if (!this->partial_frame){
+			this->partial_frame = this->next_frame();
+			if (!this->partial_frame)
+				break;
+			this->partial_position = 0;
+		}
+		auto frame = this->partial_frame;
+		auto n = std::min<size_t>(samples - written, frame->length - this->partial_position);
+		memcpy(dst + written, frame->buffer + this->partial_position, n * sizeof(StereoSampleFinal));
+		written += n;
+		this->partial_position += (unsigned)n;
+		if (this->partial_position >= frame->length){
+			this->return_used_frame(frame);
+			this->partial_frame = nullptr;
+		}
+	}
+	auto written_bytes = written * sizeof(StereoSampleFinal);
+	memset(stream + written_bytes, 0, len - written_bytes);
+	this->stats.record_callback(queued + !!this->partial_frame, samples - written);
+	//Don't let signals pile up while the scheduler is busy.
+	if (this->get_queued_frames() < this->demand_watermark && this->demand.availableApprox() <= 0)
+		this->demand.signal();
+}
+
+void AudioRenderer::set_demand_watermark(size_t watermark){
+	this->demand_watermark = watermark;
+}
+
+bool AudioRenderer::wait_for_demand(unsigned ms){
+	return this->demand.wait((std::int64_t)ms * 1000);
+}
+
+void AudioRenderer::signal_demand(){
+	this->demand.signal();
 }
@@ -1,30 +1,40 @@
 #pragma once
-#include "SoundGenerators.h"
+#include "ChannelPipeline.h"
 #include "PublishingResource.h"
 #include "AudioData.h"
+#include "AudioStats.h"
+#include "HighResolutionClock.h"
+#include "AudioCache.h"
 #include <fstream>
 #include <SDL_hints.h>
 
-//#define OUTPUT_AUDIO_TO_FILE
-
-struct Panning{
-	bool left = true,
-		right = true,
-		either = true;
-};
-
 class AudioDevice;
 
 class AudioRenderer{
-	std::mutex mutex;
+	//Only touched by the device callback.
 	std::uint64_t expected_frame = 0;
+	moodycamel::spsc_sema::LightweightSemaphore demand;
+	std::atomic<size_t> demand_watermark;
+	//Frame partially consumed by the previous device callback, if any. Only
+	//touched by the device callback.
+	AudioFrame *partial_frame = nullptr;
+	unsigned partial_position = 0;
+
+	AudioFrame *next_frame();
 protected:
 	AudioDevice *device;
+	AudioStats stats;
+	//Used to timestamp published frames.
+	HighResolutionClock clock;
 	virtual AudioFrame *get_current_frame() = 0;
 	virtual void return_used_frame(AudioFrame *frame) = 0;
 public:
+	//Number of frames published but not yet consumed by the device.
+	virtual size_t get_queued_frames() = 0;
 	AudioRenderer(AudioDevice &device);
 	virtual ~AudioRenderer();
+	unsigned get_output_frequency() const;
+	DEFINE_NON_CONST_GETTER(stats)
 	virtual void update(double now) = 0;
 	virtual void set_NR10(byte_t) = 0;
 	virtual void set_NR11(byte_t) = 0;
@@ -67,6 +77,24 @@ public:
 	virtual byte_t get_NR51() const = 0;
 	virtual byte_t get_NR52() const = 0;
 	virtual void copy_voluntary_wave(const void *buffer) = 0;
+	//Pass nullptr to stop stepping the sequencer. Must not be called while
+	//another thread may be updating the renderer.
+	virtual void set_sequencer(AudioSequencer *) = 0;
+	//Mixes a cached sound into the output, starting at the current position,
+	//until it ends or is replaced. Pass nullptr to stop.
+	virtual void mix_cached_sound(const AudioCache::Entry *) = 0;
+	//True if the output is 0 and will stay so until a channel is started. False
+	//while a cached sound is being mixed.
+	virtual bool is_silent() = 0;
 
+	//Called from the device callback. Never blocks: if not enough frames are
+	//ready, the rest of the buffer is filled with silence.
 	void write_data_to_device(Uint8 *stream, int len);
+	//After each device callback, demand is signalled if fewer than watermark
+	//frames remain queued. Pass 0 to stop signalling.
+	void set_demand_watermark(size_t watermark);
+	//Returns false if the timeout expired before demand was signalled.
+	bool wait_for_demand(unsigned ms);
+	//Wakes up the thread waiting for demand.
+	void signal_demand();
 };
@@ -1,14 +1,24 @@
 #include "AudioScheduler.h"
+#include "AudioWorkerPool.h"
 #include "Engine.h"
 #include "AudioRenderer.h"
 #include "CppRed/AudioProgram.h"
 #include "../CodeGeneration/output/audio.h"
+#include "AudioData.h"
+#include <algorithm>
 
-AudioScheduler::AudioScheduler(Engine &engine, std::unique_ptr<AudioRenderer> &&renderer, std::unique_ptr<CppRed::AudioProgram> &&program): engine(&engine){
+//Granularity with which the program and the renderer are stepped while
+//rendering ahead. Matches the period of the timer in push mode.
+static const double render_step = 0.001;
+
+AudioScheduler::AudioScheduler(Engine &engine, std::unique_ptr<AudioRenderer> &&renderer, std::unique_ptr<CppRed::AudioProgram> &&program, const AudioBufferOptions &buffer_options):
+		engine(&engine),
+		buffer_options(buffer_options){
 	this->renderer = std::move(renderer);
 	this->program = std::move(program);
 	this->continue_running = false;
-	this->timer_id = SDL_AddTimer(1, timer_callback, this);
+	this->renderer->set_NR52(0xFF);
+	this->renderer->set_NR50(0x77);
 }
 
 AudioScheduler::~AudioScheduler(){
@@ -17,21 +27,40 @@ AudioScheduler::~AudioScheduler(){
 		SDL_RemoveTimer(this->timer_id);
 }
 
-void AudioScheduler::start(){
-	if (this->thread)
+void AudioScheduler::start(bool pull_driven){
+	if (this->thread || this->pool)
 		return;
 	this->continue_running = true;
+	if (pull_driven){
+		this->renderer->set_demand_watermark(this->buffer_options.latency_frames);
+		this->thread.reset(new std::thread([this](){ this->pull_processor(); }));
+		return;
+	}
+	this->timer_id = SDL_AddTimer(1, timer_callback, this);
 	this->thread.reset(new std::thread([this](){ this->processor(); }));
 }
 
+void AudioScheduler::start(AudioWorkerPool &pool){
+	if (this->thread || this->pool)
+		return;
+	this->pool = &pool;
+	pool.add(*this);
+}
+
+bool AudioScheduler::step(){
+	try{
+		this->render_ahead();
+		return true;
+	}catch (std::exception &e){
+		this->engine->throw_exception(e);
+		return false;
+	}
+}
+
 void AudioScheduler::processor(){
 	try{
-		this->renderer->set_NR52(0xFF);
-		this->renderer->set_NR50(0x77);
 		while (this->continue_running){
-			auto now = this->engine->get_clock();
-			this->program->update(now);
-			this->renderer->update(now);
+			this->update();
 			//Delay for ~1 ms. Experimentation shows that, at least on Windows, the
 			//actual wait can last up to a few ms.
 			this->timer_event.wait();
@@ -41,9 +70,69 @@ void AudioScheduler::processor(){
 	}
 }
 
+void AudioScheduler::pull_processor(){
+	try{
+		//The timeout keeps the program running (e.g. so that code waiting for
+		//a sound effect to end doesn't hang) if the device never pulls.
+		const unsigned timeout = (unsigned)(this->buffer_options.get_frame_duration(this->renderer->get_output_frequency()) * 1000) + 1;
+		while (this->continue_running){
+			this->render_demanded();
+			this->renderer->wait_for_demand(timeout);
+		}
+	}catch (std::exception &e){
+		this->engine->throw_exception(e);
+	}
+}
+
+//Steps the program and the renderer up to latency_frames frames past the
+//current time.
+void AudioScheduler::render_ahead(){
+	auto target = this->engine->get_clock() + this->buffer_options.latency_frames * this->buffer_options.get_frame_duration(this->renderer->get_output_frequency());
+	if (this->rendered_until < 0)
+		this->rendered_until = target - render_step;
+	this->render_until(target);
+}
+
+//Renders as many frames as the queue is short of latency_frames, so how far
+//ahead the audio gets depends only on what the device has consumed. It never
+//falls behind the engine's clock, though, so that the program keeps running
+//if the device stops pulling.
+void AudioScheduler::render_demanded(){
+	auto queued = this->renderer->get_queued_frames();
+	auto latency = (size_t)this->buffer_options.latency_frames;
+	auto missing = queued < latency ? latency - queued : 0;
+	auto now = this->engine->get_clock();
+	if (this->rendered_until < 0)
+		this->rendered_until = now - render_step;
+	auto target = this->rendered_until + missing * this->buffer_options.get_frame_duration(this->renderer->get_output_frequency());
+	this->render_until(std::max(target, now));
+}
+
+//Steps the program and the renderer in render_step increments, so that
+//register writes land at the same times they would with the timer.
+void AudioScheduler::render_until(double target){
+	for (auto t = this->rendered_until + render_step; t < target; t += render_step){
+		this->program->update(t);
+		this->renderer->update(t);
+		this->rendered_until = t;
+	}
+}
+
+void AudioScheduler::update(){
+	auto now = this->engine->get_clock();
+	this->program->update(now);
+	this->renderer->update(now);
+}
+
 void AudioScheduler::stop(){
+	if (this->pool){
+		this->pool->remove(*this);
+		this->pool = nullptr;
+	}
 	if (this->thread){
 		this->continue_running = false;
+		this->renderer->set_demand_watermark(0);
+		this->renderer->signal_demand();
 		this->thread->join();
 		this->thread.reset();
 	}
@@ -1,5 +1,6 @@
 #pragma once
 #include "threads.h"
+#include "AudioData.h"
 #include <memory>
 #include <mutex>
 #include <thread>
@@ -9,6 +10,7 @@
 
 class Engine;
 class AudioRenderer;
+class AudioWorkerPool;
 enum class AudioResourceId;
 namespace CppRed{
 class AudioProgram;
@@ -19,15 +21,36 @@ class AudioScheduler{
 	std::unique_ptr<AudioRenderer> renderer;
 	std::unique_ptr<CppRed::AudioProgram> program;
 	std::unique_ptr<std::thread> thread;
+	AudioWorkerPool *pool = nullptr;
 	std::atomic<bool> continue_running;
+	AudioBufferOptions buffer_options;
 	SDL_TimerID timer_id = 0;
 	Event timer_event;
+	double rendered_until = -1;
 
 	static Uint32 SDLCALL timer_callback(Uint32 interval, void *param);
 	void processor();
+	void pull_processor();
+	void render_ahead();
+	void render_demanded();
+	void render_until(double target);
 	void stop();
 public:
-	AudioScheduler(Engine &engine, std::unique_ptr<AudioRenderer> &&renderer, std::unique_ptr<CppRed::AudioProgram> &&program);
+	AudioScheduler(Engine &engine, std::unique_ptr<AudioRenderer> &&renderer, std::unique_ptr<CppRed::AudioProgram> &&program, const AudioBufferOptions &);
 	~AudioScheduler();
-	void start();
+	//Starts the scheduler thread. If pull_driven, the thread sleeps until the
+	//device runs low on queued frames, rather than waking up every ~1 ms, and
+	//only renders the frames the device is missing.
+	void start(bool pull_driven = false);
+	//Lets the pool step the scheduler instead of starting a thread.
+	void start(AudioWorkerPool &pool);
+	//Renders ahead once. Returns false, after passing the exception to the
+	//engine, if rendering failed. Called by AudioWorkerPool.
+	bool step();
+	//Performs a single step on the calling thread. Only valid if start() has
+	//not been called.
+	void update();
+	AudioRenderer &get_renderer(){
+		return *this->renderer;
+	}
 };
@@ -0,0 +1,75 @@
+#include "AudioStats.h"
+#include <fstream>
+#include <algorithm>
+
+AudioStats::AudioStats(){
+	this->reset();
+}
+
+void AudioStats::reset(){
+	this->callbacks = 0;
+	this->underruns = 0;
+	this->silent_samples = 0;
+	this->late_frames = 0;
+	this->dropped_frames = 0;
+	this->published_frames = 0;
+	for (auto &i : this->depth_histogram)
+		i = 0;
+	for (auto &i : this->latency_histogram)
+		i = 0;
+}
+
+void AudioStats::record_callback(size_t queued_frames, size_t silent_samples){
+	this->callbacks++;
+	if (silent_samples){
+		this->underruns++;
+		this->silent_samples += silent_samples;
+	}
+	this->depth_histogram[std::min<size_t>(queued_frames, depth_buckets - 1)]++;
+}
+
+void AudioStats::record_latency(double seconds){
+	unsigned bucket = 0;
+	for (double limit = 0.001; bucket < latency_buckets - 1 && seconds >= limit; limit *= 2)
+		bucket++;
+	this->latency_histogram[bucket]++;
+}
+
+std::vector<std::string> AudioStats::to_strings(bool compact) const{
+	std::vector<std::string> ret;
+	ret.push_back("Callbacks: " + std::to_string(this->callbacks));
+	ret.push_back("Underruns: " + std::to_string(this->underruns) + " (" + std::to_string(this->silent_samples) + " samples)");
+	ret.push_back("Published frames: " + std::to_string(this->published_frames));
+	ret.push_back("Dropped frames: " + std::to_string(this->dropped_frames));
+	ret.push_back("Late frames: " + std::to_string(this->late_frames));
+	ret.push_back("Queue depth:");
+	for (unsigned i = 0; i < depth_buckets; i++){
+		std::uint64_t n = this->depth_histogram[i];
+		if (compact && !n)
+			continue;
+		auto label = std::to_string(i) + (i == depth_buckets - 1 ? "+" : "");
+		ret.push_back("  " + label + ": " + std::to_string(n));
+	}
+	ret.push_back("Frame latency:");
+	for (unsigned i = 0; i < latency_buckets; i++){
+		std::uint64_t n = this->latency_histogram[i];
+		if (compact && !n)
+			continue;
+		std::string label;
+		if (i == latency_buckets - 1)
+			label = ">=" + std::to_string(1 << (i - 1));
+		else
+			label = "<" + std::to_string(1 << i);
+		ret.push_back("  " + label + " ms: " + std::to_string(n));
+	}
+	return ret;
+}
+
+bool AudioStats::save(const std::string &path) const{
+	std::ofstream file(path);
+	if (!file)
+		return false;
+	for (auto &line : this->to_strings())
+		file << line << std::endl;
+	return !!file;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//Counters that show how close the audio output is to underrunning. They are
+//updated from the device callback and from the synthesis thread, so updating
+//them never blocks.
+class AudioStats{
+public:
+	//The last bucket also counts every greater depth.
+	static const unsigned depth_buckets = 16;
+	//Bucket i counts latencies under 2^i ms. The last bucket also counts
+	//every greater latency.
+	static const unsigned latency_buckets = 11;
+private:
+	//Device callbacks.
+	std::atomic<std::uint64_t> callbacks;
+	//Callbacks that ran out of frames and had to output silence.
+	std::atomic<std::uint64_t> underruns;
+	std::atomic<std::uint64_t> silent_samples;
+	//Frames that arrived after a later frame and were discarded.
+	std::atomic<std::uint64_t> late_frames;
+	//Frames discarded because the queue was full.
+	std::atomic<std::uint64_t> dropped_frames;
+	std::atomic<std::uint64_t> published_frames;
+	//Frames queued at the start of each callback.
+	std::atomic<std::uint64_t> depth_histogram[depth_buckets];
+	//Time from the publication of each frame until the device starts
+	//playing it.
+	std::atomic<std::uint64_t> latency_histogram[latency_buckets];
+public:
+	AudioStats();
+	void reset();
+	void record_callback(size_t queued_frames, size_t silent_samples);
+	void record_latency(double seconds);
+	void record_late_frame(){
+		this->late_frames++;
+	}
+	void record_published_frame(bool dropped){
+		if (dropped)
+			this->dropped_frames++;
+		else
+			this->published_frames++;
+	}
+	//One line per counter. If compact, empty histogram buckets are omitted.
+	std::vector<std::string> to_strings(bool compact = false) const;
+	//Returns false if the file couldn't be written.
+	bool save(const std::string &path) const;
+};
@@ -0,0 +1,77 @@
+#include "AudioWorkerPool.h"
+#include "AudioScheduler.h"
+#include "utility.h"
+#include <algorithm>
+
+AudioWorkerPool::AudioWorkerPool(unsigned threads){
+	SDL_InitSubSystem(SDL_INIT_TIMER);
+	this->continue_running = true;
+	threads = std::max(threads, 1U);
+	for (unsigned i = 0; i < threads; i++){
+		this->workers.emplace_back(new Worker);
+		auto worker = this->workers.back().get();
+		worker->thread.reset(new std::thread([this, worker](){ this->run(*worker); }));
+	}
+	this->timer_id = SDL_AddTimer(1, timer_callback, this);
+}
+
+AudioWorkerPool::~AudioWorkerPool(){
+	this->continue_running = false;
+	if (this->timer_id)
+		SDL_RemoveTimer(this->timer_id);
+	for (auto &worker : this->workers){
+		worker->timer_event.signal();
+		join_thread(worker->thread);
+	}
+	SDL_QuitSubSystem(SDL_INIT_TIMER);
+}
+
+void AudioWorkerPool::add(AudioScheduler &scheduler){
+	Worker *best = nullptr;
+	size_t best_size = 0;
+	for (auto &worker : this->workers){
+		LOCK_MUTEX(worker->mutex);
+		if (!best || worker->schedulers.size() < best_size){
+			best = worker.get();
+			best_size = worker->schedulers.size();
+		}
+	}
+	LOCK_MUTEX(best->mutex);
+	best->schedulers.push_back(&scheduler);
+}
+
+void AudioWorkerPool::remove(AudioScheduler &scheduler){
+	for (auto &worker : this->workers){
+		LOCK_MUTEX(worker->mutex);
+		auto &v = worker->schedulers;
+		auto it = std::find(v.begin(), v.end(), &scheduler);
+		if (it != v.end()){
+			v.erase(it);
+			return;
+		}
+	}
+}
+
+void AudioWorkerPool::run(Worker &worker){
+	while (this->continue_running){
+		{
+			LOCK_MUTEX(worker.mutex);
+			auto &v = worker.schedulers;
+			for (size_t i = 0; i < v.size();){
+				//A failing scheduler only stops its own engine.
+				if (v[i]->step())
+					i++;
+				else
+					v.erase(v.begin() + i);
+			}
+		}
+		worker.timer_event.wait();
+	}
+}
+
+Uint32 SDLCALL AudioWorkerPool::timer_callback(Uint32 interval, void *param){
+	auto This = (AudioWorkerPool *)param;
+	for (auto &worker : This->workers)
+		worker->timer_event.signal();
+	return interval;
+}
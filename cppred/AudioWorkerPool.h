@@ -0,0 +1,38 @@
+#pragma once
+#include "threads.h"
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <SDL.h>
+
+class AudioScheduler;
+
+//Steps the audio of many engines on a few threads, rather than one thread and
+//one timer per engine. A single timer wakes every worker every ~1 ms, and each
+//worker renders ahead the schedulers assigned to it, one after the other.
+//Every scheduler keeps its own renderer, device, and recorder. The pool holds
+//a reference to SDL's timer subsystem for as long as it exists.
+class AudioWorkerPool{
+	struct Worker{
+		//Held while the worker steps its schedulers.
+		std::mutex mutex;
+		std::vector<AudioScheduler *> schedulers;
+		Event timer_event;
+		std::unique_ptr<std::thread> thread;
+	};
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::atomic<bool> continue_running;
+	SDL_TimerID timer_id = 0;
+
+	static Uint32 SDLCALL timer_callback(Uint32 interval, void *param);
+	void run(Worker &);
+public:
+	AudioWorkerPool(unsigned threads = 1);
+	~AudioWorkerPool();
+	AudioWorkerPool(const AudioWorkerPool &) = delete;
+	void operator=(const AudioWorkerPool &) = delete;
+	//The scheduler is assigned to the worker with the fewest schedulers.
+	void add(AudioScheduler &);
+	//Once this returns, the scheduler is no longer being stepped.
+	void remove(AudioScheduler &);
+};
@@ -0,0 +1,124 @@
+#include "BlepBuffer.h"
+#include "utility.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#if defined __AVX2__
+#include <immintrin.h>
+#elif defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#define USE_SSE2_BLEP
+#include <emmintrin.h>
+#endif
+
+namespace{
+
+//Blackman-windowed sinc, cut off a little below the Nyquist frequency.
+struct BlepKernel{
+	intermediate_audio_type impulses[BlepBuffer::phases][BlepBuffer::kernel_width];
+
+	BlepKernel(){
+		const double pi = 3.14159265358979323846;
+		const double cutoff = 0.9;
+		const int width = BlepBuffer::kernel_width;
+		for (unsigned phase = 0; phase < BlepBuffer::phases; phase++){
+			double taps[BlepBuffer::kernel_width];
+			double sum = 0;
+			for (int i = 0; i < width; i++){
+				double x = i - (width / 2 - 1) - (double)phase / BlepBuffer::phases;
+				double sinc = x ? sin(pi * cutoff * x) / (pi * cutoff * x) : 1;
+				double window = 0.42 + 0.5 * cos(2 * pi * x / width) + 0.08 * cos(4 * pi * x / width);
+				taps[i] = sinc * window;
+				sum += taps[i];
+			}
+#ifdef USE_FLOAT_AUDIO
+			for (int i = 0; i < width; i++)
+				this->impulses[phase][i] = (float)(taps[i] / sum);
+#else
+			const int one = 1 << BlepBuffer::kernel_bits;
+			int total = 0;
+			int largest = 0;
+			for (int i = 0; i < width; i++){
+				this->impulses[phase][i] = (int)floor(taps[i] / sum * one + 0.5);
+				total += this->impulses[phase][i];
+				if (this->impulses[phase][i] > this->impulses[phase][largest])
+					largest = i;
+			}
+			this->impulses[phase][largest] += one - total;
+#endif
+		}
+	}
+};
+
+const BlepKernel kernel;
+
+}
+
+BlepBuffer::BlepBuffer(){
+	std::fill(this->deltas, this->deltas + array_length(this->deltas), (intermediate_audio_type)0);
+	this->accumulator = 0;
+}
+
+void BlepBuffer::add_delta(unsigned time, intermediate_audio_type delta){
+	auto dst = this->deltas + (time >> blep_phase_bits);
+	auto &impulse = kernel.impulses[time & (phases - 1)];
+	for (unsigned i = 0; i < kernel_width; i++)
+		dst[i] += delta * impulse[i];
+}
+
+void BlepBuffer::integrate(intermediate_audio_type *dst, unsigned begin, unsigned end){
+	auto accumulator = this->accumulator;
+	auto i = begin;
+#ifndef USE_FLOAT_AUDIO
+#if defined __AVX2__
+	auto running = _mm256_set1_epi32(accumulator);
+	const auto last = _mm256_set1_epi32(7);
+	for (; i + 8 <= end; i += 8){
+		auto x = _mm256_loadu_si256((const __m256i *)(this->deltas + i));
+		//Prefix sum within each 128-bit lane...
+		x = _mm256_add_epi32(x, _mm256_slli_si256(x, 4));
+		x = _mm256_add_epi32(x, _mm256_slli_si256(x, 8));
+		//...then carry the total of the low lane into the high lane.
+		auto carry = _mm256_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+		x = _mm256_add_epi32(x, _mm256_permute2x128_si256(carry, carry, 0x08));
+		x = _mm256_add_epi32(x, running);
+		running = _mm256_permutevar8x32_epi32(x, last);
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_srai_epi32(x, kernel_bits));
+	}
+	accumulator = _mm_cvtsi128_si32(_mm256_castsi256_si128(running));
+#elif defined USE_SSE2_BLEP
+	auto running = _mm_set1_epi32(accumulator);
+	for (; i + 4 <= end; i += 4){
+		auto x = _mm_loadu_si128((const __m128i *)(this->deltas + i));
+		x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+		x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+		x = _mm_add_epi32(x, running);
+		running = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_srai_epi32(x, kernel_bits));
+	}
+	accumulator = _mm_cvtsi128_si32(running);
+#endif
+	for (; i < end; i++){
+		accumulator += this->deltas[i];
+		dst[i] = accumulator >> kernel_bits;
+	}
+#else
+	for (; i < end; i++){
+		accumulator += this->deltas[i];
+		dst[i] = accumulator;
+	}
+#endif
+	this->accumulator = accumulator;
+}
+
+void BlepBuffer::next_frame(unsigned length){
+	const auto n = length;
+	std::copy(this->deltas + n, this->deltas + n + kernel_width, this->deltas);
+	std::fill(this->deltas + kernel_width, this->deltas + n + kernel_width, (intermediate_audio_type)0);
+}
+
+bool BlepBuffer::is_silent(unsigned position, unsigned length) const{
+	if (this->accumulator)
+		return false;
+	auto end = this->deltas + length + kernel_width;
+	return std::all_of(this->deltas + position, end, [](intermediate_audio_type x){ return !x; });
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "AudioData.h"
+
+//Sub-sample resolution of step times, in bits.
+static const unsigned blep_phase_bits = 5;
+
+//Band-limited step synthesis. Changes in the level of a signal are added as
+//band-limited impulses to a delta buffer, and integrating the buffer yields
+//the band-limited signal, delayed by half the kernel width. Holds one
+//AudioFrame plus the tail of the impulses that spill into the next one.
+class BlepBuffer{
+public:
+	static const unsigned kernel_width = 16;
+	static const unsigned phases = 1 << blep_phase_bits;
+#ifndef USE_FLOAT_AUDIO
+	//Fixed-point precision of the kernel. The impulses of every phase add up to
+	//exactly 1 << kernel_bits, so rounding never accumulates into a DC offset.
+	static const unsigned kernel_bits = 13;
+#endif
+private:
+	alignas(32) intermediate_audio_type deltas[AudioFrame::max_length + kernel_width];
+	intermediate_audio_type accumulator;
+public:
+	BlepBuffer();
+	//time is relative to the start of the frame, in 1/phases sample units,
+	//and must not be greater than the frame length times phases.
+	void add_delta(unsigned time, intermediate_audio_type delta);
+	//Writes samples [begin, end) of the current frame to dst[begin, end).
+	//Samples must be integrated in order, and sample n is final once no more
+	//deltas are added at times before n + 1.
+	void integrate(intermediate_audio_type *dst, unsigned begin, unsigned end);
+	//Moves the spilled tail of a frame of the given length to the start of the
+	//buffer.
+	void next_frame(unsigned length);
+	//True if every sample from position on is 0, unless more deltas are added.
+	//position must be where the last integration ended.
+	bool is_silent(unsigned position, unsigned length) const;
+};
@@ -0,0 +1,88 @@
+#pragma once
+#include "SoundGenerators.h"
+#include <cstddef>
+#include <tuple>
+#include <utility>
+
+//#define USE_VIRTUAL_GENERATOR_DISPATCH
+
+struct Panning{
+	bool left = true,
+		right = true,
+		either = true;
+};
+
+//Calls the per-sample functions of a generator of a known type directly,
+//which lets the compiler inline them.
+template <typename T>
+class StaticChannel{
+	T *generator;
+public:
+	StaticChannel(T &generator): generator(&generator){}
+	void update_state_before_render(std::uint64_t time){
+		this->generator->T::update_state_before_render(time);
+	}
+	intermediate_audio_type render(std::uint64_t time) const{
+		return this->generator->T::render(time);
+	}
+};
+
+//Calls the per-sample functions of a generator through its vtable.
+class VirtualChannel{
+	WaveformGenerator *generator;
+public:
+	VirtualChannel(WaveformGenerator &generator): generator(&generator){}
+	void update_state_before_render(std::uint64_t time){
+		this->generator->update_state_before_render(time);
+	}
+	intermediate_audio_type render(std::uint64_t time) const{
+		return this->generator->render(time);
+	}
+};
+
+//Renders one sample of each of a fixed list of channels. The list is expanded
+//at compile time, so with StaticChannels all the per-sample work of every
+//channel ends up in a single function.
+template <typename... Channels>
+class ChannelPipeline{
+	std::tuple<Channels...> channels;
+
+	template <typename T>
+	static StereoSampleIntermediate render_channel(T &channel, std::uint64_t time, const Panning &pan){
+		channel.update_state_before_render(time);
+		StereoSampleIntermediate ret;
+		if (!!pan.either){
+			auto value = channel.render(time);
+
+			ret.left = value * !!pan.left;
+			ret.right = value * !!pan.right;
+		}else
+			ret.left = ret.right = 0;
+
+		return ret;
+	}
+	template <size_t... Indices>
+	void render(std::uint64_t time, const Panning *panning, StereoSampleIntermediate *dst, std::index_sequence<Indices...>){
+		int expand[] = { (dst[Indices] = render_channel(std::get<Indices>(this->channels), time, panning[Indices]), 0)... };
+		(void)expand;
+	}
+public:
+	static const size_t size = sizeof...(Channels);
+
+	ChannelPipeline(Channels... channels): channels(channels...){}
+	//Writes one sample per channel to dst, in order.
+	void render(std::uint64_t time, const Panning *panning, StereoSampleIntermediate *dst){
+		this->render(time, panning, dst, std::index_sequence_for<Channels...>());
+	}
+};
+
+#ifdef USE_VIRTUAL_GENERATOR_DISPATCH
+typedef ChannelPipeline<VirtualChannel, VirtualChannel, VirtualChannel, VirtualChannel> StandardChannelPipeline;
+#else
+typedef ChannelPipeline<
+	StaticChannel<Square1Generator>,
+	StaticChannel<Square2Generator>,
+	StaticChannel<VoluntaryWaveGenerator>,
+	StaticChannel<NoiseGenerator>
+> StandardChannelPipeline;
+#endif
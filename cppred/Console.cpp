@@ -2,6 +2,7 @@
 #include "Renderer.h"
 #include "Engine.h"
 #include "CppRed/AudioProgram.h"
+#include "AudioStats.h"
 #include "../CodeGeneration/output/audio.h"
 #include "font.inl"
 
@@ -206,6 +207,13 @@ CppRed::AudioProgram &Console::get_audio_program(){
 	return *ccc.audio_program;
 }
 
+AudioStats &Console::get_audio_stats(){
+	ConsoleCommunicationChannel ccc;
+	ccc.request_id = ConsoleRequestId::GetAudioStats;
+	(*this->yielder)(&ccc);
+	return *ccc.audio_stats;
+}
+
 void Console::draw_long_menu(const std::vector<std::string> &strings, int item_separation){
 	auto h = this->text_layer.get_size().y;
 	const auto max_visible = h / (8 * item_separation * text_scale) - 2;
@@ -278,6 +286,7 @@ void Console::coroutine_entry_point(){
 		main_menu.push_back("Restart");
 		main_menu.push_back((std::string)"Version: " + to_string(this->get_version()));
 		main_menu.push_back("Sound test");
+		main_menu.push_back("Audio stats");
 
 		bool run = true;
 		while (run){
@@ -295,6 +304,9 @@ void Console::coroutine_entry_point(){
 				case 2:
 					this->sound_test();
 					break;
+				case 3:
+					this->audio_stats();
+					break;
 			}
 		}
 	}
@@ -303,7 +315,7 @@ void Console::coroutine_entry_point(){
 void Console::sound_test(){
 	this->engine->go_to_debug();
 	auto &program = this->get_audio_program();
-	CppRed::AudioInterface audio_interface(program);
+	CppRed::AudioInterface audio_interface(*this->engine, program);
 	auto sounds = program.get_resource_strings();
 	sounds.erase(sounds.begin());
 	sounds.push_back("Stop");
@@ -314,6 +326,48 @@ void Console::sound_test(){
 	}
 }
 
+//Shows the statistics, updated every frame, above a small menu.
+void Console::audio_stats(){
+	static const char * const options[] = {
+		"Back",
+		"Reset",
+		"Save to audio_stats.txt",
+	};
+	const int option_count = (int)array_length(options);
+	auto &stats = this->get_audio_stats();
+	this->current_menu_position = 0;
+	this->current_menu_size = option_count;
+	this->selected = false;
+	while (true){
+		std::fill(this->character_matrix.begin(), this->character_matrix.end(), 0);
+		int y = 1;
+		for (auto &line : stats.to_strings(true))
+			this->write_string(1, y++, line.c_str());
+		y++;
+		for (int i = 0; i < option_count; i++){
+			this->write_string(3, y + i, options[i]);
+			if (i == this->current_menu_position)
+				this->write_character(1, y + i, 0x10);
+		}
+		this->yield();
+		this->current_menu_position = euclidean_modulo(this->current_menu_position, this->current_menu_size);
+		if (!this->selected)
+			continue;
+		this->selected = false;
+		switch (this->current_menu_position){
+			case 0:
+				std::fill(this->character_matrix.begin(), this->character_matrix.end(), 0);
+				return;
+			case 1:
+				stats.reset();
+				break;
+			case 2:
+				stats.save("audio_stats.txt");
+				break;
+		}
+	}
+}
+
 void Console::restart_game(){
 	ConsoleCommunicationChannel ccc;
 	ccc.request_id = ConsoleRequestId::Restart;
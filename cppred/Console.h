@@ -9,6 +9,7 @@
 #include "pokemon_version.h"
 
 class Engine;
+class AudioStats;
 
 enum class ConsoleRequestId{
 	None,
@@ -16,12 +17,14 @@ enum class ConsoleRequestId{
 	Restart,
 	FlipVersion,
 	GetVersion,
+	GetAudioStats,
 };
 
 struct ConsoleCommunicationChannel{
 	ConsoleRequestId request_id = ConsoleRequestId::None;
 	CppRed::AudioProgram *audio_program = nullptr;
 	PokemonVersion version;
+	AudioStats *audio_stats = nullptr;
 };
 
 class Console{
@@ -53,10 +56,12 @@ class Console{
 	void coroutine_entry_point();
 	void yield();
 	CppRed::AudioProgram &get_audio_program();
+	AudioStats &get_audio_stats();
 
 	int handle_menu(const std::vector<std::string> &, int default_item = 0, int item_separation = 1);
 	void draw_long_menu(const std::vector<std::string> &strings, int item_separation = 1);
 	void sound_test();
+	void audio_stats();
 	void restart_game();
 	void flip_version();
 	PokemonVersion get_version();
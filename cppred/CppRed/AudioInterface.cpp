@@ -1,33 +1,52 @@
 #include "AudioInterface.h"
 #include "AudioProgram.h"
+#include "Engine.h"
 #include "../CodeGeneration/output/audio.h"
 
 namespace CppRed{
 
-AudioInterface::AudioInterface(AudioProgram &program): program(&program){
+AudioInterface::AudioInterface(Engine &engine, AudioProgram &program): engine(&engine), program(&program){
 	this->new_sound_id = AudioResourceId::None;
 	this->last_music_sound_id = AudioResourceId::None;
 	this->after_fade_out_play_this = AudioResourceId::None;
 }
 
+void AudioInterface::post(AudioCommandType type, AudioResourceId id, int value){
+	AudioCommand command;
+	command.type = type;
+	command.sound_id = id;
+	command.value = value;
+	command.time = this->engine->get_clock();
+	this->program->post(command);
+}
+
+void AudioInterface::post(AudioCommandType type){
+	this->post(type, AudioResourceId::None);
+}
+
+//Commands that haven't been executed yet may start an SFX, so they count as
+//playing.
+bool AudioInterface::sfx_playing(){
+	return !this->program->get_commands_executed() || this->program->get_status().sfx_playing;
+}
+
 void AudioInterface::play_sound(AudioResourceId id){
-	auto lock = this->program->acquire_lock();
 	if (this->new_sound_id != AudioResourceId::None)
-		for (int i = 4; i < 8; i++)
-			this->program->clear_channel(i);
-	if (this->program->get_fade_control()){
+		this->post(AudioCommandType::StopSfx);
+	if (this->fade_control){
 		if (this->new_sound_id == AudioResourceId::None)
 			return;
 		this->new_sound_id = AudioResourceId::None;
 		if (this->last_music_sound_id == AudioResourceId::Stop){
 			this->after_fade_out_play_this = this->last_music_sound_id = id;
-			this->program->copy_fade_control();
+			this->post(AudioCommandType::StartFadeOut);
 			return;
 		}
-		this->program->set_fade_control(0);
+		this->fade_control = 0;
+		this->post(AudioCommandType::SetFadeControl, AudioResourceId::None, 0);
 	}
 	this->new_sound_id = AudioResourceId::None;
-	this->program->play_sound(id);
+	this->post(AudioCommandType::PlaySound, id);
 }
 
 void AudioInterface::play_cry(SpeciesId){
@@ -35,15 +54,16 @@ void AudioInterface::play_cry(SpeciesId){
 }
 
 void AudioInterface::pause_music(){
-	this->program->pause_music();
+	this->post(AudioCommandType::PauseMusic);
 }
 
 void AudioInterface::unpause_music(){
-	this->program->unpause_music();
+	this->post(AudioCommandType::UnpauseMusic);
 }
 
 void AudioInterface::wait_for_sfx_to_end(){
-	this->program->wait_for_sfx_to_end();
+	while (this->sfx_playing())
+		this->engine->yield();
 }
 
 }
@@ -2,18 +2,29 @@
 
 enum class AudioResourceId;
 enum class SpeciesId;
+class Engine;
 
 namespace CppRed{
 
 class AudioProgram;
+enum class AudioCommandType;
 
+//Drives the AudioProgram from the game coroutine. It only posts commands and
+//reads status snapshots, so it never contends with the audio thread.
 class AudioInterface{
+	Engine *engine;
 	AudioProgram *program;
 	AudioResourceId new_sound_id;
 	AudioResourceId last_music_sound_id;
 	AudioResourceId after_fade_out_play_this;
+	//Value last posted with SetFadeControl.
+	int fade_control = 0;
+
+	void post(AudioCommandType type, AudioResourceId id, int value = 0);
+	void post(AudioCommandType type);
+	bool sfx_playing();
 public:
-	AudioInterface(AudioProgram &program);
+	AudioInterface(Engine &engine, AudioProgram &program);
 	AudioInterface(const AudioInterface &) = delete;
 	AudioInterface(AudioInterface &&) = delete;
 	void operator=(const AudioInterface &) = delete;
@@ -2,134 +2,21 @@
 #include "Data.h"
 #include "utility.h"
 #include "AudioRenderer.h"
+#include "AudioCache.h"
 #include "../common/calculate_frequency.h"
 #include "../CodeGeneration/output/audio.h"
 #include <set>
 #include <sstream>
 
-const byte_t command_parameter_counts[] = {
-	1, //tempo
-	2, //volume
-	1, //duty
-	1, //duty_cycle
-	3, //vibrato
-	0, //toggle_perfect_pitch
-	3, //note_type
-	1, //rest
-	1, //octave
-	2, //note
-	1, //dspeed
-	2, //noise_instrument
-	1, //unknown_sfx_10
-	3, //unknown_sfx_20
-	3, //unknown_noise_20
-	0, //execute_music
-	2, //pitch_bend
-	1, //stereo_panning
-	2, //loop
-	1, //call
-	1, //goto
-	0, //ifred
-	0, //else
-	0, //endif
-	0, //end
-};
-
-#define DECLARE_COMMAND_FUNCTION_IN_ARRAY(x) &AudioProgram::Channel::command_##x
+//Computed goto is a GCC extension. Elsewhere, the interpreter dispatches
+//through a switch.
+#if defined __GNUC__ && !defined AUDIO_DISPATCH_WITH_SWITCH
+#define AUDIO_DISPATCH_WITH_COMPUTED_GOTO
+#endif
 
 namespace CppRed{
 
-const AudioProgram::Channel::command_function AudioProgram::Channel::command_functions[28] = {
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(Tempo),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(Volume),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(Duty),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(DutyCycle),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(Vibrato),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(TogglePerfectPitch),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(NoteType),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(Rest),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(Octave),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(Note),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(DSpeed),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(NoiseInstrument),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(UnknownSfx10),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(UnknownSfx20),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(UnknownNoise20),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(ExecuteMusic),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(PitchBend),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(StereoPanning),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(Loop),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(Call),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(Goto),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(IfRed),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(Else),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(EndIf),
-	DECLARE_COMMAND_FUNCTION_IN_ARRAY(End),
-};
-
-#define DEFINE_AC_STRUCT0(name)
-#define DEFINE_AC_STRUCT1(name, p1)                  \
-	struct name##AudioCommand{                       \
-		std::uint32_t p1;                            \
-		name##AudioCommand(const AudioCommand &cmd): \
-			p1(cmd.params[0]){}                      \
-	}
-#define DEFINE_AC_STRUCT2(name, p1, p2)              \
-	struct name##AudioCommand{                       \
-		std::uint32_t p1;                            \
-		std::uint32_t p2;                            \
-		name##AudioCommand(const AudioCommand &cmd): \
-			p1(cmd.params[0]),                       \
-			p2(cmd.params[1]){}                      \
-	}
-#define DEFINE_AC_STRUCT3(name, p1, p2, p3)          \
-	struct name##AudioCommand{                       \
-		std::uint32_t p1;                            \
-		std::uint32_t p2;                            \
-		std::uint32_t p3;                            \
-		name##AudioCommand(const AudioCommand &cmd): \
-			p1(cmd.params[0]),                       \
-			p2(cmd.params[1]),                       \
-			p3(cmd.params[2]){}                      \
-	}
-#define DEFINE_AC_STRUCT4(name, p1, p2, p3, p4)      \
-	struct name##AudioCommand{                       \
-		std::uint32_t p1;                            \
-		std::uint32_t p2;                            \
-		std::uint32_t p3;                            \
-		std::uint32_t p4;                            \
-		name##AudioCommand(const AudioCommand &cmd): \
-			p1(cmd.params[0]),                       \
-			p2(cmd.params[1]),                       \
-			p3(cmd.params[2]),                       \
-			p4(cmd.params[3]){}                      \
-	}
-
-DEFINE_AC_STRUCT1(Tempo, tempo);
-DEFINE_AC_STRUCT2(Volume, vol1, vol2);
-DEFINE_AC_STRUCT1(Duty, duty);
-DEFINE_AC_STRUCT1(DutyCycle, duty);
-DEFINE_AC_STRUCT3(Vibrato, delay, rate, depth);
-DEFINE_AC_STRUCT0(TogglePerfectPitch);
-DEFINE_AC_STRUCT3(NoteType, speed, volume, fade);
-DEFINE_AC_STRUCT1(Rest, length);
-DEFINE_AC_STRUCT1(Octave, octave);
-DEFINE_AC_STRUCT2(Note, pitch, length);
-DEFINE_AC_STRUCT1(DSpeed, speed);
-DEFINE_AC_STRUCT2(NoiseInstrument, pitch, length);
-DEFINE_AC_STRUCT1(UnknownSfx10, nr10);
-DEFINE_AC_STRUCT3(UnknownSfx20, length, envelope, frequency);
-DEFINE_AC_STRUCT3(UnknownNoise20, length, envelope, frequency);
-DEFINE_AC_STRUCT0(ExecuteMusic);
-DEFINE_AC_STRUCT2(PitchBend, length, frequency);
-DEFINE_AC_STRUCT1(StereoPanning, value);
-DEFINE_AC_STRUCT2(Loop, times, dst);
-DEFINE_AC_STRUCT1(Call, dst);
-DEFINE_AC_STRUCT1(Goto, dst);
-DEFINE_AC_STRUCT0(IfRed);
-DEFINE_AC_STRUCT0(Else);
-DEFINE_AC_STRUCT0(EndIf);
-DEFINE_AC_STRUCT0(End);
+#include "../CodeGeneration/output/audio_program.inl"
 
 static const byte_t disable_channel_masks[] = {
 	BITMAP(11101110),
@@ -192,26 +79,12 @@ static const instrument_data_t * const * const instruments_by_bank[] = {
 };
 
 AudioProgram::AudioProgram(AudioRenderer &renderer, PokemonVersion version): renderer(&renderer), version(version){
-	this->load_commands();
 	this->load_resources();
+	this->publish_status();
 }
 
-void AudioProgram::load_commands(){
-	static_assert(array_length(command_parameter_counts) == (size_t)AudioCommandType::End + 1, "Error: command_parameter_counts must have as many elements as there are command types!");
-	auto buffer = audio_sequence_data;
-	size_t offset = 0;
-	const size_t size = audio_sequence_data_size;
-	this->commands.resize(read_varint(buffer, offset, size));
-	for (auto &command : this->commands){
-		auto type = read_varint(buffer, offset, size);
-		if (type > (std::uint32_t)AudioCommandType::End)
-			throw std::runtime_error("AudioProgram::load_commands(): Invalid data.");
-		command.type = (AudioCommandType)type;
-		std::fill(command.params, command.params + array_length(command.params), std::numeric_limits<std::uint32_t>::max());
-		for (int i = 0; i < (int)command_parameter_counts[type]; i++)
-			command.params[i] = read_varint(buffer, offset, size);
-	}
-	assert(offset == size);
+AudioProgram::~AudioProgram(){
+	this->set_sample_accurate(false);
 }
 
 void AudioProgram::load_resources(){
@@ -237,10 +110,12 @@ void AudioProgram::load_resources(){
 	}
 }
 
-const double AudioProgram::update_threshold = 4389.0 / 262144.0;
+const double AudioProgram::update_threshold = (double)sequencer_period / gb_cpu_frequency;
 
 void AudioProgram::update(double now){
 	LOCK_MUTEX(this->mutex);
+	if (this->sample_accurate)
+		return;
 	auto delta = now - this->last_update;
 	if (this->last_update < 0){
 		this->last_update = now;
@@ -250,20 +125,82 @@ void AudioProgram::update(double now){
 		return;
 	int n = (int)(delta * (1.0 / update_threshold));
 	
-	for (int i = n; i--;)
-		this->perform_update();
+	for (int i = 1; i <= n; i++)
+		this->perform_update(this->last_update + i * update_threshold);
 	this->last_update = now - (delta - n * update_threshold);
 }
 
+void AudioProgram::set_sample_accurate(bool enable){
+	if (enable == this->sample_accurate)
+		return;
+	this->sample_accurate = enable;
+	this->last_update = -1;
+	this->renderer->set_sequencer(enable ? this : nullptr);
+}
+
+void AudioProgram::sequencer_tick(double time){
+	LOCK_MUTEX(this->mutex);
+	this->perform_update(time);
+}
+
+void AudioProgram::post(const AudioCommand &command){
+	this->commands.enqueue(command);
+	this->posted_commands++;
+}
+
+void AudioProgram::execute_commands(double time){
+	while (true){
+		auto command = this->commands.peek();
+		if (!command || command->time > time)
+			break;
+		this->execute_command(*command);
+		this->commands.pop();
+		this->executed_commands++;
+	}
+}
+
+void AudioProgram::execute_command(const AudioCommand &command){
+	switch (command.type){
+		case AudioCommandType::PlaySound:
+			this->play_sound(command.sound_id);
+			break;
+		case AudioCommandType::StopSfx:
+			for (int i = 4; i < 8; i++)
+				this->clear_channel(i);
+			this->stop_cached_sfx();
+			break;
+		case AudioCommandType::PauseMusic:
+			this->pause_music_state = PauseMusicState::PauseRequested;
+			break;
+		case AudioCommandType::UnpauseMusic:
+			this->pause_music_state = PauseMusicState::NotPaused;
+			break;
+		case AudioCommandType::SetFadeControl:
+			this->set_fade_control(command.value);
+			break;
+		case AudioCommandType::StartFadeOut:
+			this->copy_fade_control();
+			break;
+	}
+}
+
+void AudioProgram::publish_status(){
+	AudioStatus status;
+	status.executed_commands = this->executed_commands;
+	status.playing = !!this->cached_sfx_ticks;
+	for (auto &c : this->channels)
+		status.playing |= !!c;
+	status.sfx_playing = this->is_sfx_playing();
+	status.music_paused = this->pause_music_state != PauseMusicState::NotPaused;
+	this->status.store(status);
+}
+
 void AudioProgram::update_channel(int i){
 	auto &c = this->channels[i];
 	if (!c)
 		return;
-	if (!c->update()){
+	if (!c->update())
 		c.reset();
-		if (i >= 4 && !this->is_sfx_playing())
-			this->sfx_finish_event.signal();
-	}
 }
 
 void AudioProgram::compute_fade_out(){
@@ -271,7 +208,8 @@ void AudioProgram::compute_fade_out(){
 	this->renderer->set_NR50(0x77);
 }
 
-void AudioProgram::perform_update(){
+void AudioProgram::perform_update(double time){
+	this->execute_commands(time);
 	this->compute_fade_out();
 	int c = 0;
 	if (this->pause_music_state == PauseMusicState::NotPaused){
@@ -281,12 +219,15 @@ void AudioProgram::perform_update(){
 		c = 4;
 	for (; c < array_length(this->channels); c++)
 		this->update_channel(c);
+	if (this->cached_sfx_ticks && !--this->cached_sfx_ticks)
+		this->end_cached_sfx();
 	if (this->pause_music_state == PauseMusicState::PauseRequested){
 		this->renderer->set_NR51(0);
 		this->renderer->set_NR30(0);
 		this->renderer->set_NR30(0x80);
 		this->pause_music_state = PauseMusicState::PauseRequestFulfilled;
 	}
+	this->publish_status();
 }
 
 void AudioProgram::pause_music(){
@@ -355,33 +296,62 @@ bool AudioProgram::Channel::play_next_note(){
 	return this->continue_execution();
 }
 
+//Runs commands until one returns false. With computed goto, each handler
+//jumps directly to the next one, rather than going back to a single dispatch
+//point.
 bool AudioProgram::Channel::continue_execution(){
 	bool ret = true;
-	while (true){
-		auto &command = this->program->commands[this->program_counter++];
-		this->program_counter %= this->program->commands.size();
-		if (!this->ifred_execute_bit)
-			continue;
-		if (!(this->*this->command_functions[(int)command.type])(command, ret))
+	const AudioInstruction *instruction;
+#ifdef AUDIO_DISPATCH_WITH_COMPUTED_GOTO
+#define AUDIO_OPCODE_LABEL(x) &&opcode_##x,
+	static const void * const dispatch_table[] = {
+		AUDIO_OPCODES(AUDIO_OPCODE_LABEL)
+	};
+#undef AUDIO_OPCODE_LABEL
+#define AUDIO_DISPATCH() \
+	instruction = audio_program + this->program_counter++; \
+	goto *dispatch_table[(int)instruction->opcode]
+#define AUDIO_OPCODE_HANDLER(x) \
+	opcode_##x: \
+		if (!this->command_##x(*instruction, ret)) \
+			return ret; \
+		AUDIO_DISPATCH();
+
+	AUDIO_DISPATCH();
+	AUDIO_OPCODES(AUDIO_OPCODE_HANDLER)
+#undef AUDIO_OPCODE_HANDLER
+#undef AUDIO_DISPATCH
+#else
+#define AUDIO_OPCODE_HANDLER(x) \
+		case AudioOpcode::x: \
+			if (!this->command_##x(*instruction, ret)) \
+				return ret; \
 			break;
+
+	while (true){
+		instruction = audio_program + this->program_counter++;
+		switch (instruction->opcode){
+			AUDIO_OPCODES(AUDIO_OPCODE_HANDLER)
+		}
 	}
-	return ret;
+#undef AUDIO_OPCODE_HANDLER
+#endif
 }
 
-#define DEFINE_COMMAND_FUNCTION(x) bool AudioProgram::Channel::command_##x(const AudioCommand &command_, bool &dont_stop_this_channel)
+#define DEFINE_COMMAND_FUNCTION(x) bool AudioProgram::Channel::command_##x(const AudioInstruction &instruction, bool &dont_stop_this_channel)
 //#define LOG_COMMAND_EXECUTION
 
 DEFINE_COMMAND_FUNCTION(Tempo){
-	TempoAudioCommand command(command_);
+	auto tempo = instruction.word;
 #ifdef LOG_COMMAND_EXECUTION
-	std::cout << "tempo " << command.tempo << std::endl;
+	std::cout << "tempo " << tempo << std::endl;
 #endif
 	int offset;
 	if (this->channel_no < 4){
-		this->program->music_tempo = command.tempo;
+		this->program->music_tempo = tempo;
 		offset = 0;
 	}else{
-		this->program->sfx_tempo = command.tempo;
+		this->program->sfx_tempo = tempo;
 		offset = 4;
 	}
 	for (int i = 0; i < 4; i++){
@@ -393,43 +363,44 @@ DEFINE_COMMAND_FUNCTION(Tempo){
 }
 
 DEFINE_COMMAND_FUNCTION(Volume){
-	VolumeAudioCommand command(command_);
+	auto nr50 = instruction.a;
 #ifdef LOG_COMMAND_EXECUTION
-	std::cout << "volume " << command.vol1 << " " << command.vol2 << std::endl;
+	std::cout << "volume " << (nr50 & 0x0F) << " " << (nr50 >> 4) << std::endl;
 #endif
-	this->program->renderer->set_NR50((byte_t)((command.vol1 & 0x0F) | ((command.vol2 & 0x0F) << 4)));
+	this->program->renderer->set_NR50(nr50);
 	return true;
 }
 
 DEFINE_COMMAND_FUNCTION(Duty){
-	DutyAudioCommand command(command_);
+	auto duty = instruction.a;
 #ifdef LOG_COMMAND_EXECUTION
-	std::cout << "duty " << command.duty << std::endl;
+	std::cout << "duty " << (int)duty << std::endl;
 #endif
-	this->duty = command.duty;
+	this->duty = duty;
 	return true;
 }
 
 DEFINE_COMMAND_FUNCTION(DutyCycle){
-	DutyCycleAudioCommand command(command_);
+	auto duty_cycle = instruction.a;
 #ifdef LOG_COMMAND_EXECUTION
-	std::cout << "duty_cycle " << command.duty << std::endl;
+	std::cout << "duty_cycle " << (int)duty_cycle << std::endl;
 #endif
-	this->duty_cycle = command.duty;
-	this->duty = command.duty & 0xC0;
+	this->duty_cycle = duty_cycle;
+	this->duty = duty_cycle & 0xC0;
 	this->do_rotate_duty = true;
 	return true;
 }
 
 DEFINE_COMMAND_FUNCTION(Vibrato){
-	VibratoAudioCommand command(command_);
+	auto delay = instruction.a;
+	auto depth = instruction.b;
+	auto extent = instruction.word;
 #ifdef LOG_COMMAND_EXECUTION
-	std::cout << "vibrato " << command.delay << " " << command.rate << " " << command.depth << std::endl;
+	std::cout << "vibrato " << (int)delay << " " << extent << " " << (int)depth << std::endl;
 #endif
-	this->vibrato_delay_counter_reload_value = this->vibrato_delay_counter = command.delay;
-	this->vibrato_extent = command.rate / 2;
-	this->vibrato_extent += (this->vibrato_extent + command.rate % 2) << 4;
-	this->vibrato_length = this->vibrato_counter = command.depth;
+	this->vibrato_delay_counter_reload_value = this->vibrato_delay_counter = delay;
+	this->vibrato_extent = extent;
+	this->vibrato_length = this->vibrato_counter = depth;
 	return true;
 }
 
@@ -442,11 +413,13 @@ DEFINE_COMMAND_FUNCTION(TogglePerfectPitch){
 }
 
 DEFINE_COMMAND_FUNCTION(NoteType){
-	NoteTypeAudioCommand command(command_);
+	auto speed = instruction.a;
+	auto volume = instruction.b;
+	auto fade = instruction.c;
 #ifdef LOG_COMMAND_EXECUTION
-	std::cout << "note_type " << command.speed << " " << command.volume << " " << command.fade << std::endl;
+	std::cout << "note_type " << (int)speed << " " << (int)volume << " " << (int)fade << std::endl;
 #endif
-	this->note_speed = command.speed;
+	this->note_speed = speed;
 
 	int *dst = nullptr;
 	if (this->channel_no == 2)
@@ -454,21 +427,21 @@ DEFINE_COMMAND_FUNCTION(NoteType){
 	else if (this->channel_no == 6)
 		dst = &this->program->sfx_wave_instrument;
 	if (dst){
-		*dst = command.fade;
-		this->volume = (command.volume * 2) % 16;
+		*dst = fade;
+		this->volume = (volume * 2) % 16;
 	}else{
-		this->volume = command.volume;
-		this->fade = command.fade;
+		this->volume = volume;
+		this->fade = fade;
 	}
 	return true;
 }
 
 DEFINE_COMMAND_FUNCTION(Rest){
-	RestAudioCommand command(command_);
+	auto length = instruction.a;
 #ifdef LOG_COMMAND_EXECUTION
-	std::cout << "rest " << command.length << std::endl;
+	std::cout << "rest " << (int)length << std::endl;
 #endif
-	this->set_delay_counters(command.length);
+	this->set_delay_counters(length);
 	if (this->channel_no < 4 && this->program->channels[4 + this->channel_no])
 		return true;
 	if (this->channel_no % 4 == 2){
@@ -482,36 +455,38 @@ DEFINE_COMMAND_FUNCTION(Rest){
 }
 
 DEFINE_COMMAND_FUNCTION(Octave){
-	OctaveAudioCommand command(command_);
+	auto octave = instruction.a;
 #ifdef LOG_COMMAND_EXECUTION
-	std::cout << "octave " << command.octave << std::endl;
+	std::cout << "octave " << (int)octave << std::endl;
 #endif
-	this->octave = command.octave;
+	this->octave = octave;
 	return true;
 }
 
 DEFINE_COMMAND_FUNCTION(Note){
-	NoteAudioCommand command(command_);
+	auto pitch = instruction.a;
+	auto length = instruction.b;
 #ifdef LOG_COMMAND_EXECUTION
-	std::cout << "note " << command.pitch << " " << command.length << std::endl;
+	std::cout << "note " << (int)pitch << " " << (int)length << std::endl;
 #endif
-	this->note_length(command.length, command.pitch);
+	this->note_length(length, pitch);
 	return false;
 }
 
 DEFINE_COMMAND_FUNCTION(DSpeed){
-	DSpeedAudioCommand command(command_);
+	auto speed = instruction.a;
 #ifdef LOG_COMMAND_EXECUTION
-	std::cout << "dspeed " << command.speed << std::endl;
+	std::cout << "dspeed " << (int)speed << std::endl;
 #endif
-	this->note_speed = command.speed;
+	this->note_speed = speed;
 	return true;
 }
 
 DEFINE_COMMAND_FUNCTION(NoiseInstrument){
-	NoiseInstrumentAudioCommand command(command_);
+	auto pitch = instruction.a;
+	auto length = instruction.b;
 #ifdef LOG_COMMAND_EXECUTION
-	std::cout << "noise_instrument " << command.pitch << " " << command.length << std::endl;
+	std::cout << "noise_instrument " << (int)pitch << " " << (int)length << std::endl;
 #endif
 	if (!this->program->stop_when_sfx_ends){
 		static const AudioResourceId noises[] = {
@@ -535,58 +510,50 @@ DEFINE_COMMAND_FUNCTION(NoiseInstrument){
 			AudioResourceId::SFX_Muted_Snare3,
 			AudioResourceId::SFX_Muted_Snare4,
 		};
-		if (!command.pitch || command.pitch >= array_length(noises) + 1){
+		if (!pitch || pitch >= array_length(noises) + 1){
 			std::stringstream stream;
-			stream << "Bad noise instrument command. Attempt to call invalid noise " << (int)command.pitch - 1;
+			stream << "Bad noise instrument command. Attempt to call invalid noise " << (int)pitch - 1;
 			throw std::runtime_error(stream.str());
 		}
-		auto pitch = command.pitch - 1;
-		this->program->play_sound(noises[pitch]);
+		this->program->play_sound(noises[pitch - 1]);
 	}
-	this->note_length(command.length, command.pitch);
+	this->note_length(length, pitch);
 	return false;
 }
 
 DEFINE_COMMAND_FUNCTION(UnknownSfx10){
-#ifndef LOG_COMMAND_EXECUTION
-	if (this->channel_no < 4 || this->do_execute_music)
-		return true;
-	UnknownSfx10AudioCommand command(command_);
-#else
-	UnknownSfx10AudioCommand command(command_);
-	std::cout << "unknown_sfx_10 " << command.nr10 << std::endl;
+#ifdef LOG_COMMAND_EXECUTION
+	std::cout << "unknown_sfx_10 " << (int)instruction.a << std::endl;
+#endif
 	if (this->channel_no < 4 || this->do_execute_music)
 		return true;
-#endif
-	this->program->renderer->set_NR10((byte_t)command.nr10);
+	this->program->renderer->set_NR10(instruction.a);
 	return true;
 }
 
 DEFINE_COMMAND_FUNCTION(UnknownSfx20){
-	return this->unknown20(command_, dont_stop_this_channel, false);
+	return this->unknown20(instruction, dont_stop_this_channel, false);
 }
 
 DEFINE_COMMAND_FUNCTION(UnknownNoise20){
-	return this->unknown20(command_, dont_stop_this_channel, true);
+	return this->unknown20(instruction, dont_stop_this_channel, true);
 }
 
-bool AudioProgram::Channel::unknown20(const AudioCommand &command_, bool &dont_stop_this_channel, bool noise){
-#ifndef LOG_COMMAND_EXECUTION
-	if (this->channel_no < 3 || this->do_execute_music)
-		return true;
-	UnknownSfx20AudioCommand command(command_);
-#else
-	UnknownSfx20AudioCommand command(command_);
-	std::cout << (noise ? "unknown_noise_20 " : "unknown_sfx_20 ") << command.length << " " << command.envelope << " " << command.frequency << std::endl;
+bool AudioProgram::Channel::unknown20(const AudioInstruction &instruction, bool &dont_stop_this_channel, bool noise){
+	auto length = instruction.a;
+	auto envelope = instruction.b;
+	auto frequency = instruction.word;
+#ifdef LOG_COMMAND_EXECUTION
+	std::cout << (noise ? "unknown_noise_20 " : "unknown_sfx_20 ") << (int)length << " " << (int)envelope << " " << frequency << std::endl;
+#endif
 	if (this->channel_no < 3 || this->do_execute_music)
 		return true;
-#endif
-	this->note_length(command.length, 2);
+	this->note_length(length, 2);
 	this->program->set_register(RegisterId::DutySoundLength, this->channel_no, this->duty | this->note_delay_counter);
-	this->program->set_register(RegisterId::VolumeEnvelope, this->channel_no, command.envelope);
+	this->program->set_register(RegisterId::VolumeEnvelope, this->channel_no, envelope);
 	this->apply_duty_and_sound_length();
 	this->enable_channel_output();
-	this->apply_wave_pattern_and_frequency(command.frequency);
+	this->apply_wave_pattern_and_frequency(frequency);
 	return false;
 }
 
@@ -599,37 +566,39 @@ DEFINE_COMMAND_FUNCTION(ExecuteMusic){
 }
 
 DEFINE_COMMAND_FUNCTION(PitchBend){
-	PitchBendAudioCommand command(command_);
+	auto length = instruction.a;
+	auto frequency = instruction.word;
 #ifdef LOG_COMMAND_EXECUTION
-	std::cout << "pitch_bend " << command.length << " " << command.frequency << std::endl;
+	std::cout << "pitch_bend " << (int)length << " " << frequency << std::endl;
 #endif
-	this->pitch_bend_length = command.length;
-	this->pitch_bend_target_frequency = command.frequency;
+	this->pitch_bend_length = length;
+	this->pitch_bend_target_frequency = frequency;
 	this->do_pitch_bend = true;
 	return true;
 }
 
 DEFINE_COMMAND_FUNCTION(StereoPanning){
-	StereoPanningAudioCommand command(command_);
+	auto panning = instruction.a;
 #ifdef LOG_COMMAND_EXECUTION
-	std::cout << "stereo_panning " << command.value << std::endl;
+	std::cout << "stereo_panning " << (int)panning << std::endl;
 #endif
-	this->program->stereo_panning = command.value;
+	this->program->stereo_panning = panning;
 	return true;
 }
 
 DEFINE_COMMAND_FUNCTION(Loop){
-	LoopAudioCommand command(command_);
+	auto times = instruction.a;
+	auto dst = instruction.word;
 #ifdef LOG_COMMAND_EXECUTION
-	std::cout << "loop " << command.times << " " << command.dst << std::endl;
+	std::cout << "loop " << (int)times << " " << dst << std::endl;
 #endif
-	if (!command.times){
-		this->program_counter = command.dst;
+	if (!times){
+		this->program_counter = dst;
 		return true;
 	}
-	if (this->loop_counter < command.times){
+	if (this->loop_counter < times){
 		this->loop_counter++;
-		this->program_counter = command.dst;
+		this->program_counter = dst;
 		return true;
 	}
 	this->loop_counter = 1;
@@ -637,47 +606,34 @@ DEFINE_COMMAND_FUNCTION(Loop){
 }
 
 DEFINE_COMMAND_FUNCTION(Call){
-	CallAudioCommand command(command_);
+	auto dst = instruction.word;
 #ifdef LOG_COMMAND_EXECUTION
-	std::cout << "call " << command.dst << std::endl;
+	std::cout << "call " << dst << std::endl;
 #endif
 	if (this->call_stack.size())
 		std::cout << "Assumption in audio program might have been invalidated.\n";
 	this->call_stack.push_back(this->program_counter);
-	this->program_counter = command.dst;
+	this->program_counter = dst;
 	return true;
 }
 
 DEFINE_COMMAND_FUNCTION(Goto){
-	GotoAudioCommand command(command_);
-#ifdef LOG_COMMAND_EXECUTION
-	std::cout << "goto " << command.dst << std::endl;
-#endif
-	this->program_counter = command.dst;
-	return true;
-}
-
-DEFINE_COMMAND_FUNCTION(IfRed){
-#ifdef LOG_COMMAND_EXECUTION
-	std::cout << "ifred\n";
-#endif
-	this->ifred_execute_bit = this->program->version == PokemonVersion::Red;
-	return true;
-}
-
-DEFINE_COMMAND_FUNCTION(Else){
+	auto dst = instruction.word;
 #ifdef LOG_COMMAND_EXECUTION
-	std::cout << "else\n";
+	std::cout << "goto " << dst << std::endl;
 #endif
-	this->ifred_execute_bit = !ifred_execute_bit;
+	this->program_counter = dst;
 	return true;
 }
 
-DEFINE_COMMAND_FUNCTION(EndIf){
+//ifred blocks are resolved by the code generator. This is the jump past the
+//Red-only commands.
+DEFINE_COMMAND_FUNCTION(JumpUnlessRed){
 #ifdef LOG_COMMAND_EXECUTION
-	std::cout << "endif\n";
+	std::cout << "jump_unless_red " << instruction.word << std::endl;
 #endif
-	this->ifred_execute_bit = true;
+	if (this->program->version != PokemonVersion::Red)
+		this->program_counter = instruction.word;
 	return true;
 }
 
@@ -901,6 +857,7 @@ void AudioProgram::play_sound(AudioResourceId id){
 		return;
 	this->sound_id = id;
 	if (id == AudioResourceId::Stop){
+		this->stop_cached_sfx();
 		//Turn on sound hardware.
 		this->renderer->set_NR52(0x80);
 		//Turn on voluntary wave.
@@ -946,6 +903,9 @@ void AudioProgram::play_sound(AudioResourceId id){
 	this->current_resource = &this->resources[offset];
 	if (resource.type == AudioResourceType::Music){
 		//play music
+		//Music can't be mixed over the cached SFX, since they'd share the
+		//channels.
+		this->stop_cached_sfx();
 		this->disable_channel_output_when_sfx_ends = false;
 		this->music_tempo -= this->music_tempo & 0xFF;
 		this->music_wave_instrument = 0;
@@ -966,8 +926,12 @@ void AudioProgram::play_sound(AudioResourceId id){
 			auto &c = this->channels[channel.channel];
 			c.reset(new Channel(*this, channel.channel, id, channel.entry_point, this->current_resource->bank));
 		}
-	}else{
+	}else if (!this->play_cached_sfx(id)){
 		//play SFX
+		//Same priority rule as for the channels below.
+		if (this->cached_sfx_ticks && id > this->cached_sfx_id)
+			return;
+		this->stop_cached_sfx();
 		for (size_t i = 0; i < this->current_resource->channel_count; i++){
 			auto &channel = this->current_resource->channels[i];
 			auto &c = this->channels[channel.channel];
@@ -990,19 +954,9 @@ void AudioProgram::play_sound(AudioResourceId id){
 	}
 	if (this->current_resource->type == AudioResourceType::Cry && this->channels[6]){
 		//Overwrite the program counter of channel 6 to make it terminate immediately on the next
-		//update, or just destroy the object if that's somehow not possible.
-		for (int pc = 0; ; pc++){
-			assert(this->commands.size() <= std::numeric_limits<int>::max());
-			if (pc == this->commands.size()){
-				//This should never happen.
-				this->channels[6].reset();
-				break;
-			}
-			if (this->commands[pc].type == AudioCommandType::End){
-				this->channels[6]->set_program_counter(pc);
-				break;
-			}
-		}
+		//update. The last instruction of the program is always an End.
+		static_assert(array_length(audio_program) <= std::numeric_limits<int>::max(), "Audio program too large.");
+		this->channels[6]->set_program_counter((int)array_length(audio_program) - 1);
 	}
 	if (!this->saved_volume){
 		this->saved_volume = this->renderer->get_NR50();
@@ -1011,6 +965,41 @@ void AudioProgram::play_sound(AudioResourceId id){
 	}
 }
 
+//The cached PCM was rendered from silence, with the hardware on at full
+//volume and no modifiers, so it's only valid in that state. Anything else is
+//synthesized.
+bool AudioProgram::play_cached_sfx(AudioResourceId id){
+	if (!this->cache || this->cached_sfx_ticks)
+		return false;
+	auto entry = this->cache->get(id);
+	if (!entry)
+		return false;
+	for (auto &c : this->channels)
+		if (c)
+			return false;
+	if (this->tempo_modifier || this->frequency_modifier || this->pause_music_state != PauseMusicState::NotPaused)
+		return false;
+	if (!(this->renderer->get_NR52() & bit(7)) || this->renderer->get_NR50() != 0x77 || !this->renderer->is_silent())
+		return false;
+	this->renderer->mix_cached_sound(entry);
+	this->cached_sfx_ticks = entry->ticks;
+	this->cached_sfx_id = id;
+	return true;
+}
+
+//Cries restore the volume when they end, as disable_channel_output_sub() would.
+void AudioProgram::end_cached_sfx(){
+	if (this->get_resource_type(this->cached_sfx_id) != AudioResourceType::Cry)
+		return;
+	this->renderer->set_NR50(this->saved_volume);
+	this->saved_volume = 0;
+}
+
+void AudioProgram::stop_cached_sfx(){
+	this->renderer->mix_cached_sound(nullptr);
+	this->cached_sfx_ticks = 0;
+}
+
 AudioProgram::Channel::Channel(AudioProgram &program, int channel_no, AudioResourceId resource_id, int entry_point, int bank){
 	this->program = &program;
 	this->channel_no = channel_no;
@@ -1057,7 +1046,6 @@ void AudioProgram::Channel::reset(AudioResourceId resource_id, int entry_point,
 	this->fade = 0;
 	this->octave = 5;
 	this->do_rotate_duty = false;
-	this->ifred_execute_bit = true;
 }
 
 #define DEFINE_REGISTER_FUNCTION(reg, ch, dst) \
@@ -1139,16 +1127,15 @@ bool AudioProgram::is_sfx_playing(){
 	bool any = false;
 	for (int i = 4; i < array_length(this->channels) && !any; i++)
 		any = !!this->channels[i];
-	return any;
+	return any || this->cached_sfx_ticks;
 }
 
-void AudioProgram::wait_for_sfx_to_end(){
-	{
-		LOCK_MUTEX(this->mutex);
-		if (!this->is_sfx_playing())
-			return;
-	}
-	this->sfx_finish_event.reset_and_wait();
+bool AudioProgram::get_playing(){
+	LOCK_MUTEX(this->mutex);
+	for (auto &c : this->channels)
+		if (c)
+			return true;
+	return !!this->cached_sfx_ticks;
 }
 
 }
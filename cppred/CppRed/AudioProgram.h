@@ -1,23 +1,21 @@
 #pragma once
 #include "Data.h"
-#include "../common/AudioCommandType.h"
+#include "AudioData.h"
+#include "../common/AudioBytecode.h"
 #include "../common/AudioResourceType.h"
 #include "pokemon_version.h"
-#include "threads.h"
+#include "queue/readerwriterqueue.h"
 #include <mutex>
+#include <atomic>
 #include <memory>
 #include <string>
 
 class AudioRenderer;
+class AudioCache;
 enum class AudioResourceId;
 
 namespace CppRed{
 
-struct AudioCommand{
-	AudioCommandType type;
-	std::uint32_t params[4];
-};
-
 struct AudioResource{
 	struct Channel{
 		std::uint32_t channel;
@@ -30,10 +28,38 @@ struct AudioResource{
 	AudioResourceType type;
 };
 
-class AudioProgram{
+enum class AudioCommandType{
+	PlaySound,
+	//Clears the SFX channels.
+	StopSfx,
+	PauseMusic,
+	UnpauseMusic,
+	SetFadeControl,
+	StartFadeOut,
+};
+
+struct AudioCommand{
+	AudioCommandType type;
+	AudioResourceId sound_id;
+	int value;
+	//The command is executed at the first tick at or after this time.
+	double time;
+};
+
+//Snapshot of the program's state, published after every tick.
+struct AudioStatus{
+	//Number of posted commands executed so far.
+	std::uint32_t executed_commands;
+	bool playing;
+	bool sfx_playing;
+	bool music_paused;
+};
+
+class AudioProgram : public AudioSequencer{
 	static const double update_threshold;
 	double last_update = -1;
-	std::vector<AudioCommand> commands;
+	//If set, the renderer steps the program instead of update().
+	bool sample_accurate = false;
 	std::vector<AudioResource> resources;
 
 	AudioRenderer *renderer;
@@ -60,7 +86,15 @@ class AudioProgram{
 	int fade_out_control = 0;
 	int fade_out_counter = 0;
 	int fade_out_counter_reload_value = 0;
-	Event sfx_finish_event;
+	moodycamel::ReaderWriterQueue<AudioCommand> commands;
+	std::uint32_t executed_commands = 0;
+	std::atomic<AudioStatus> status;
+	//Only touched by the thread that posts commands.
+	std::uint32_t posted_commands = 0;
+	const AudioCache *cache = nullptr;
+	//Ticks left until the SFX being mixed from the cache ends.
+	unsigned cached_sfx_ticks = 0;
+	AudioResourceId cached_sfx_id;
 	class Channel{
 		CppRed::AudioProgram *program;
 		AudioResourceId sound_id;
@@ -94,7 +128,6 @@ class AudioProgram{
 		bool do_pitch_bend = false;
 		bool pitch_bend_decreasing = false;
 		bool vibrato_direction = false;
-		bool ifred_execute_bit = true;
 		bool perfect_pitch = false;
 
 		bool apply_effects();
@@ -116,8 +149,7 @@ class AudioProgram{
 		int init_pitch_bend_variables(int frequency);
 		void set_sfx_tempo();
 
-		typedef bool (Channel::*command_function)(const AudioCommand &, bool &);
-#define DECLARE_COMMAND_FUNCTION(x) bool command_##x(const AudioCommand &, bool &)
+#define DECLARE_COMMAND_FUNCTION(x) bool command_##x(const AudioInstruction &, bool &)
 		DECLARE_COMMAND_FUNCTION(Tempo);
 		DECLARE_COMMAND_FUNCTION(Volume);
 		DECLARE_COMMAND_FUNCTION(Duty);
@@ -139,12 +171,9 @@ class AudioProgram{
 		DECLARE_COMMAND_FUNCTION(Loop);
 		DECLARE_COMMAND_FUNCTION(Call);
 		DECLARE_COMMAND_FUNCTION(Goto);
-		DECLARE_COMMAND_FUNCTION(IfRed);
-		DECLARE_COMMAND_FUNCTION(Else);
-		DECLARE_COMMAND_FUNCTION(EndIf);
+		DECLARE_COMMAND_FUNCTION(JumpUnlessRed);
 		DECLARE_COMMAND_FUNCTION(End);
-		bool unknown20(const AudioCommand &, bool &dont_stop_this_channel, bool noise);
-		static const command_function command_functions[28];
+		bool unknown20(const AudioInstruction &, bool &dont_stop_this_channel, bool noise);
 	public:
 		Channel(CppRed::AudioProgram &program, int channel_no, AudioResourceId resource_id, int entry_point, int bank);
 		bool update();
@@ -165,7 +194,6 @@ class AudioProgram{
 	};
 	std::unique_ptr<Channel> channels[8];
 
-	void load_commands();
 	void load_resources();
 	bool is_cry();
 	enum class RegisterId{
@@ -182,18 +210,54 @@ class AudioProgram{
 	byte_t get_register(RegisterId reg, int channel_no){
 		return this->get_register_pointer(reg, channel_no)(*this->renderer, -1);
 	}
-	void perform_update();
+	void perform_update(double time);
+	void execute_commands(double time);
+	void execute_command(const AudioCommand &);
+	void publish_status();
 	void update_channel(int);
 	void compute_fade_out();
 	bool is_sfx_playing();
+	bool play_cached_sfx(AudioResourceId);
+	void end_cached_sfx();
+	void stop_cached_sfx();
 public:
 	AudioProgram(AudioRenderer &renderer, PokemonVersion);
+	~AudioProgram();
+	//Does nothing if the program is sample accurate.
 	void update(double now);
+	//When enabled, the program is stepped by the renderer at fixed points of
+	//the synthesis timeline, rather than by update() according to the wall
+	//clock, so the output doesn't depend on when update() is called. Must not
+	//be called while another thread may be updating the renderer.
+	void set_sample_accurate(bool);
+	void sequencer_tick(double time) override;
+	//Queues a command without blocking. Commands must all be posted from the
+	//same thread. They're executed by the thread that updates the program, at
+	//the start of a tick.
+	void post(const AudioCommand &);
+	//Never blocks.
+	AudioStatus get_status() const{
+		return this->status.load();
+	}
+	//True if every command posted so far has been executed. Must be called
+	//from the thread that posts commands.
+	bool get_commands_executed() const{
+		return this->get_status().executed_commands == this->posted_commands;
+	}
 	void play_sound(AudioResourceId);
 	void pause_music();
 	void unpause_music();
 	void clear_channel(int channel);
 	std::vector<std::string> get_resource_strings();
+	AudioResourceType get_resource_type(AudioResourceId id) const{
+		return this->resources[(size_t)id].type;
+	}
+	//SFX played while nothing else is playing and the renderer is silent are
+	//mixed from the cache, if they're in it. The cache must outlive the
+	//program, and must have been rendered for the same version.
+	void set_cache(const AudioCache *cache){
+		this->cache = cache;
+	}
 	std::unique_lock<std::mutex> acquire_lock();
 	int get_fade_control() const{
 		return this->fade_out_control;
@@ -202,7 +266,8 @@ public:
 		this->fade_out_control = f;
 	}
 	void copy_fade_control();
-	void wait_for_sfx_to_end();
+	//True if any channel, music or SFX, is still running.
+	bool get_playing();
 };
 
 }
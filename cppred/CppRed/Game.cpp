@@ -30,7 +30,7 @@ const FadePaletteData fade_palettes[8] = {
 Game::Game(Engine &engine, PokemonVersion version, CppRed::AudioProgram &program):
 		engine(&engine),
 		version(version),
-		audio_interface(program){
+		audio_interface(engine, program){
 	this->engine->set_on_yield([this](){ this->update_joypad_state(); });
 	this->reset_dialog_state();
 }
@@ -4,33 +4,54 @@
 #include "AudioScheduler.h"
 #include "AudioDevice.h"
 #include "HeliosRenderer.h"
+#include "AudioRecorder.h"
+#include "AudioCache.h"
 #include "Console.h"
 #include <stdexcept>
 #include <cassert>
 
 const double Engine::logical_refresh_rate = (double)dmg_clock_frequency / dmg_display_period;
 const double Engine::logical_refresh_period = (double)dmg_display_period / dmg_clock_frequency;
+//Subsystems are reference counted, so several engines can share them.
+static const Uint32 sdl_subsystems = SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER;
 
-Engine::Engine():
+Engine::Engine(const EngineOptions &options):
 		prng(get_seed()),
-		main_thread_id(std::this_thread::get_id()){
-	SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER);
+		main_thread_id(std::this_thread::get_id()),
+		options(options),
+		frame_counter(0),
+		version(PokemonVersion::Red){
+	if (!this->options.headless)
+		SDL_InitSubSystem(sdl_subsystems);
 
 	this->initialize_video();
 	this->initialize_audio();
+	if (this->options.input_script.size())
+		this->input_script.reset(new InputScript(this->options.input_script));
+	if (this->options.record_input.size())
+		this->input_recorder.reset(new InputRecorder(this->options.record_input));
+	if (this->options.frame_hashes.size()){
+		auto size = Point{ Renderer::logical_screen_width, Renderer::logical_screen_height };
+		if (this->options.upscaler != Upscaler::None)
+			size *= this->options.screen_scale;
+		this->frame_hash_writer.reset(new FrameHashWriter(this->options.frame_hashes, size.x, size.y));
+	}
 }
 
 Engine::~Engine(){
-	this->audio_scheduler.reset();
-	SDL_Quit();
+	this->end_session();
+	if (!this->options.headless)
+		SDL_QuitSubSystem(sdl_subsystems);
 }
 
 void Engine::initialize_video(){
-	this->video_device = Renderer::initialize_device(4);
+	this->video_device = Renderer::initialize_device(this->options.screen_scale, this->options.headless);
 }
 
 void Engine::initialize_audio(){
-	this->audio_device.reset(new AudioDevice);
+	this->audio_device.reset(new AudioDevice(this->options.headless, this->options.audio_buffers));
+	if (this->options.record_audio.size())
+		this->audio_recorder.reset(new AudioRecorder(this->options.record_audio, this->options.audio_stems));
 }
 
 static const char *to_string(PokemonVersion version){
@@ -45,51 +66,116 @@ static const char *to_string(PokemonVersion version){
 }
 
 void Engine::run(){
+	if (this->options.frames)
+		this->step(this->options.frames);
+	else
+		while (this->step());
+	this->end_session();
+}
+
+bool Engine::step(std::uint64_t frames){
 	if (std::this_thread::get_id() != this->main_thread_id)
-		throw std::runtime_error("Engine::run() must be called from the main thread!");
+		throw std::runtime_error("Engine::step() must be called from the main thread!");
 
-	PokemonVersion version = PokemonVersion::Red;
-	bool continue_running = true;
-	while (continue_running){
-		this->video_device->set_window_title(to_string(version));
-		this->wait_remainder = 0;
-		this->debug_mode = false;
-		this->renderer.reset(new Renderer(*this->video_device));
-		if (!this->console)
-			this->console.reset(new Console(*this));
-		auto audio_renderer = std::make_unique<HeliosRenderer>(*this->audio_device);
-		auto programp = std::make_unique<CppRed::AudioProgram>(*audio_renderer, version);
-		auto &program = *programp;
-		this->audio_scheduler.reset(new AudioScheduler(*this, std::move(audio_renderer), std::move(programp)));
-		this->audio_scheduler->start();
-		this->coroutine.reset(new coroutine_t([this, version, &program](yielder_t &y){ this->coroutine_entry_point(y, version, program); }));
-		auto yielder = this->yielder;
-		this->yielder = nullptr;
-
-		//Main loop.
-		while ((continue_running &= this->handle_events()) && this->update_console(version, program)){
-			{
-				LOCK_MUTEX(this->exception_thrown_mutex);
-				if (this->exception_thrown)
-					throw std::runtime_error(*this->exception_thrown);
-			}
-
-			if (!this->debug_mode){
-				//Resume game code.
-				std::swap(yielder, this->yielder);
-				continue_running &= !!(*this->coroutine)();
-				std::swap(yielder, this->yielder);
-			}
-
-			this->renderer->render();
-			this->console->render();
-			this->video_device->present();
+	for (; frames; frames--){
+		if (!this->coroutine)
+			this->start_session();
+		if (!this->run_frame()){
+			this->end_session();
+			return false;
 		}
+	}
+	return true;
+}
 
-		this->on_yield = decltype(this->on_yield)();
-		this->coroutine.reset();
-		this->audio_scheduler.reset();
+void Engine::start_session(){
+	this->video_device->set_window_title(to_string(this->version));
+	this->wait_remainder = 0;
+	this->debug_mode = false;
+	this->renderer.reset(new Renderer(*this->video_device, this->options.upscaler, this->options.render_threads));
+	this->renderer->set_compute_frame_hash(!!this->frame_hash_writer);
+	if (!this->console)
+		this->console.reset(new Console(*this));
+	auto audio_renderer = std::make_unique<HeliosRenderer>(*this->audio_device, this->options.audio_buffers);
+	audio_renderer->set_recorder(this->audio_recorder.get());
+	auto programp = std::make_unique<CppRed::AudioProgram>(*audio_renderer, this->version);
+	programp->set_sample_accurate(this->options.sample_accurate_audio);
+	if (this->options.audio_cache){
+		auto cache = this->options.shared_audio_caches[(int)this->version];
+		if (!cache){
+			if (!this->audio_cache || this->audio_cache->get_version() != this->version)
+				this->audio_cache.reset(new AudioCache(this->version));
+			cache = this->audio_cache.get();
+		}
+		programp->set_cache(cache);
+	}
+	this->audio_program = programp.get();
+	this->audio_scheduler.reset(new AudioScheduler(*this, std::move(audio_renderer), std::move(programp), this->options.audio_buffers));
+	//In headless mode the audio is stepped from the main loop, in lockstep
+	//with the virtual clock.
+	if (!this->options.headless){
+		if (this->options.audio_pool)
+			this->audio_scheduler->start(*this->options.audio_pool);
+		else
+			this->audio_scheduler->start(this->options.pull_audio);
 	}
+	auto version = this->version;
+	auto program = this->audio_program;
+	this->coroutine.reset(new coroutine_t([this, version, program](yielder_t &y){ this->coroutine_entry_point(y, version, *program); }));
+	this->suspended_yielder = this->yielder;
+	this->yielder = nullptr;
+}
+
+void Engine::end_session(){
+	this->on_yield = decltype(this->on_yield)();
+	this->coroutine.reset();
+	this->suspended_yielder = nullptr;
+	if (this->audio_scheduler && this->options.audio_stats.size())
+		this->audio_scheduler->get_renderer().get_stats().save(this->options.audio_stats);
+	this->audio_scheduler.reset();
+	this->audio_program = nullptr;
+}
+
+//Runs a single iteration of the main loop. Returns false if the engine should
+//stop.
+bool Engine::run_frame(){
+	if (!this->handle_events())
+		return false;
+	this->update_input();
+	if (!this->update_console(this->version, *this->audio_program)){
+		this->end_session();
+		return true;
+	}
+
+	{
+		LOCK_MUTEX(this->exception_thrown_mutex);
+		if (this->exception_thrown)
+			throw std::runtime_error(*this->exception_thrown);
+	}
+
+	bool continue_running = true;
+	if (!this->debug_mode){
+		//Resume game code.
+		std::swap(this->suspended_yielder, this->yielder);
+		continue_running = !!(*this->coroutine)();
+		std::swap(this->suspended_yielder, this->yielder);
+	}
+	if (this->options.headless)
+		this->audio_scheduler->update();
+
+	this->renderer->render();
+	if (this->frame_hash_writer)
+		this->frame_hash_writer->write(this->renderer->get_frame_hash());
+	this->console->render();
+	this->video_device->present();
+	return continue_running;
+}
+
+void Engine::update_input(){
+	if (this->input_script)
+		this->input_state = this->input_script->get_state(this->frame_counter);
+	if (this->input_recorder)
+		this->input_recorder->record(this->frame_counter, this->input_state);
 }
 
 bool Engine::update_console(PokemonVersion &version, CppRed::AudioProgram &program){
@@ -109,6 +195,9 @@ bool Engine::update_console(PokemonVersion &version, CppRed::AudioProgram &progr
 			case ConsoleRequestId::GetVersion:
 				console_request->version = version;
 				break;
+			case ConsoleRequestId::GetAudioStats:
+				console_request->audio_stats = &this->audio_scheduler->get_renderer().get_stats();
+				break;
 			default:
 				return true;
 		}
@@ -129,6 +218,7 @@ void Engine::yield(){
 	if (!this->yielder)
 		throw std::runtime_error("Engine::yield() must be called while the coroutine is active!");
 	(*this->yielder)();
+	this->frame_counter++;
 	if (this->on_yield)
 		this->on_yield();
 }
@@ -146,6 +236,8 @@ void Engine::wait(double s){
 }
 
 double Engine::get_clock(){
+	if (this->options.get_deterministic_clock())
+		return this->frame_counter * logical_refresh_period;
 	return this->clock.get();
 }
 
@@ -188,6 +280,8 @@ static void handle_event(InputState &state, SDL_Event &event, bool &flag){
 }
 
 bool Engine::handle_events(){
+	if (this->options.headless)
+		return true;
 	SDL_Event event;
 	auto &state = this->input_state;
 	bool button_down = false;
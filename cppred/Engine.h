@@ -3,9 +3,13 @@
 #include "InputState.h"
 #include "Renderer.h"
 #include "HighResolutionClock.h"
+#include "InputScript.h"
+#include "FrameHash.h"
+#include "AudioData.h"
 #include <SDL.h>
 #include <boost/coroutine2/all.hpp>
 #include <thread>
+#include <atomic>
 #include <memory>
 
 #ifdef min
@@ -21,11 +25,70 @@ class Renderer;
 class Console;
 class AudioDevice;
 class AudioScheduler;
+class AudioWorkerPool;
+class AudioCache;
+class AudioRecorder;
 
 namespace CppRed{
 class AudioProgram;
 }
 
+struct EngineOptions{
+	//Run without a window or sound card. The clock advances by exactly one
+	//logical frame per yield, so the game runs as fast as possible.
+	bool headless = false;
+	//Size of the window, relative to the logical screen.
+	int screen_scale = 4;
+	//When not None, the frame is scaled up by the CPU rather than by the video
+	//device.
+	Upscaler upscaler = Upscaler::None;
+	//Threads used to render each frame, including the main thread. 0 means
+	//one thread per core.
+	unsigned render_threads = 1;
+	//If not empty, the joypad is driven by this InputScript instead of by the
+	//keyboard.
+	std::string input_script;
+	//If not empty, the joypad states are recorded to this file as an
+	//InputScript.
+	std::string record_input;
+	//If not empty, the hash of every frame is written to this file as a frame
+	//hash stream.
+	std::string frame_hashes;
+	//If not zero, run() returns after running this many frames.
+	std::uint64_t frames = 0;
+	//Synthesize only the audio frames the device has consumed, when it runs low
+	//on queued frames, instead of polling the clock every ~1 ms.
+	bool pull_audio = false;
+	//If not null, the audio is stepped by this pool, which may be shared by
+	//several engines, instead of by a thread of its own. pull_audio is then
+	//ignored. The pool must outlive the engine.
+	AudioWorkerPool *audio_pool = nullptr;
+	//Step the audio program in synthesis time rather than wall clock time
+	//(see AudioProgram::set_sample_accurate()).
+	bool sample_accurate_audio = false;
+	//Mix SFX from PCM rendered once in the background (see AudioCache).
+	bool audio_cache = false;
+	//Indexed by PokemonVersion. If audio_cache is set, the cache for the
+	//current version is used instead of one of the engine's own, so that
+	//several engines render the SFX only once. The caches must outlive the
+	//engine.
+	const AudioCache *shared_audio_caches[2] = {};
+	AudioBufferOptions audio_buffers;
+	//If not empty, the audio output is saved to this WAV file.
+	std::string record_audio;
+	//When recording audio, also save each channel to its own file.
+	bool audio_stems = false;
+	//If not empty, the audio statistics of each session are saved to this
+	//file when the session ends.
+	std::string audio_stats;
+
+	//With a deterministic clock, the clock advances by exactly one logical
+	//frame per yield, so that sessions can be replayed exactly.
+	bool get_deterministic_clock() const{
+		return this->headless || this->input_script.size() || this->record_input.size();
+	}
+};
+
 class Engine{
 	HighResolutionClock clock;
 	SDL_Window *window = nullptr;
@@ -37,9 +100,24 @@ class Engine{
 	typedef boost::coroutines2::asymmetric_coroutine<void>::push_type yielder_t;
 	std::unique_ptr<coroutine_t> coroutine;
 	yielder_t *yielder = nullptr;
+	//Holds the yielder while the coroutine is suspended.
+	yielder_t *suspended_yielder = nullptr;
 	std::thread::id main_thread_id;
+	EngineOptions options;
 	double wait_remainder = 0;
+	//Yields since the engine started. Read by the audio thread.
+	std::atomic<std::uint64_t> frame_counter;
 	InputState input_state;
+	std::unique_ptr<InputScript> input_script;
+	std::unique_ptr<InputRecorder> input_recorder;
+	std::unique_ptr<FrameHashWriter> frame_hash_writer;
+	//Must outlive audio_scheduler.
+	std::unique_ptr<AudioRecorder> audio_recorder;
+	//Must outlive audio_scheduler. Only used if options.shared_audio_caches has
+	//no cache for the current version.
+	std::unique_ptr<AudioCache> audio_cache;
+	PokemonVersion version;
+	CppRed::AudioProgram *audio_program = nullptr;
 	std::function<void()> on_yield;
 	std::unique_ptr<AudioScheduler> audio_scheduler;
 	std::unique_ptr<Console> console;
@@ -50,16 +128,23 @@ class Engine{
 	void initialize_video();
 	void initialize_audio();
 	void coroutine_entry_point(yielder_t &, PokemonVersion, CppRed::AudioProgram &);
+	void start_session();
+	void end_session();
+	bool run_frame();
 	bool handle_events();
+	void update_input();
 	bool update_console(PokemonVersion &version, CppRed::AudioProgram &program);
 public:
-	Engine();
+	Engine(const EngineOptions & = EngineOptions());
 	~Engine();
 	Engine(const Engine &) = delete;
 	Engine(Engine &&other) = delete;
 	void operator=(const Engine &) = delete;
 	void operator=(Engine &&) = delete;
 	void run();
+	//Runs the given number of iterations of the main loop. Returns false if
+	//the engine was asked to quit.
+	bool step(std::uint64_t frames = 1);
 	DEFINE_NON_CONST_GETTER(prng)
 	Renderer &get_renderer(){
 		return *this->renderer;
@@ -73,13 +158,18 @@ public:
 		this->yield();
 	}
 	double get_clock();
+	std::uint64_t get_frame_counter() const{
+		return this->frame_counter;
+	}
+	bool get_headless() const{
+		return this->options.headless;
+	}
 	void set_on_yield(std::function<void()> &&);
 	DEFINE_GETTER(input_state)
 
 	void go_to_debug();
 	void restart();
 	void throw_exception(const std::exception &e);
-	static const int screen_scale = 4;
 	static const int dmg_clock_frequency = 1 << 22;
 	static const int dmg_display_period = 70224;
 	static const double logical_refresh_rate;
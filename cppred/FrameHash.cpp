@@ -0,0 +1,178 @@
+#include "FrameHash.h"
+#include "../common/FrameHashStream.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#if defined __AVX2__
+#include <immintrin.h>
+#elif defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#define USE_SSE2_FRAME_HASH
+#include <emmintrin.h>
+#endif
+
+static const std::uint64_t prime32_1 = 0x9E3779B1ULL;
+static const std::uint64_t prime64_1 = 0x9E3779B185EBCA87ULL;
+static const std::uint64_t prime64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const std::uint64_t prime64_3 = 0x165667B19E3779F9ULL;
+static const std::uint64_t prime64_4 = 0x85EBCA77C2B2AE63ULL;
+static const std::uint64_t prime64_5 = 0x27D4EB2F165667C5ULL;
+static const int lanes = 8;
+static const size_t stripe_size = lanes * sizeof(std::uint64_t);
+//The accumulators are scrambled after every block of this many stripes.
+static const size_t stripes_per_block = 16;
+
+alignas(32) static const std::uint64_t secret[lanes] = {
+	0xBE4BA423396CFEB8ULL, 0x1CAD21F72C81017CULL,
+	0xDB979083E96DD4DEULL, 0x1F67B3B7A4A44072ULL,
+	0x78E5C0CC4EE679CBULL, 0x2172FFCC7DD05A82ULL,
+	0x8E2443F7744608B8ULL, 0x4C263A81E69035E0ULL,
+};
+
+static std::uint64_t read_u64(const byte_t *p){
+	std::uint64_t ret;
+	memcpy(&ret, p, sizeof(ret));
+	return ret;
+}
+
+static std::uint64_t rotl(std::uint64_t x, int n){
+	return (x << n) | (x >> (64 - n));
+}
+
+#if defined __AVX2__
+static void accumulate(std::uint64_t (&acc)[lanes], const byte_t *p, size_t stripes){
+	__m256i a[2];
+	__m256i keys[2];
+	for (int i = 0; i < 2; i++){
+		a[i] = _mm256_load_si256((const __m256i *)acc + i);
+		keys[i] = _mm256_load_si256((const __m256i *)secret + i);
+	}
+	for (size_t s = 0; s < stripes; s++, p += stripe_size){
+		for (int i = 0; i < 2; i++){
+			auto data = _mm256_loadu_si256((const __m256i *)p + i);
+			auto key = _mm256_xor_si256(data, keys[i]);
+			auto product = _mm256_mul_epu32(key, _mm256_srli_epi64(key, 32));
+			a[i] = _mm256_add_epi64(a[i], _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2)));
+			a[i] = _mm256_add_epi64(a[i], product);
+		}
+	}
+	for (int i = 0; i < 2; i++)
+		_mm256_store_si256((__m256i *)acc + i, a[i]);
+}
+
+static void scramble(std::uint64_t (&acc)[lanes]){
+	const auto prime = _mm256_set1_epi32((int)prime32_1);
+	for (int i = 0; i < 2; i++){
+		auto a = _mm256_load_si256((const __m256i *)acc + i);
+		a = _mm256_xor_si256(a, _mm256_srli_epi64(a, 47));
+		a = _mm256_xor_si256(a, _mm256_load_si256((const __m256i *)secret + i));
+		auto lo = _mm256_mul_epu32(a, prime);
+		auto hi = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), prime);
+		_mm256_store_si256((__m256i *)acc + i, _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32)));
+	}
+}
+#elif defined USE_SSE2_FRAME_HASH
+static void accumulate(std::uint64_t (&acc)[lanes], const byte_t *p, size_t stripes){
+	__m128i a[4];
+	__m128i keys[4];
+	for (int i = 0; i < 4; i++){
+		a[i] = _mm_load_si128((const __m128i *)acc + i);
+		keys[i] = _mm_load_si128((const __m128i *)secret + i);
+	}
+	for (size_t s = 0; s < stripes; s++, p += stripe_size){
+		for (int i = 0; i < 4; i++){
+			auto data = _mm_loadu_si128((const __m128i *)p + i);
+			auto key = _mm_xor_si128(data, keys[i]);
+			auto product = _mm_mul_epu32(key, _mm_srli_epi64(key, 32));
+			a[i] = _mm_add_epi64(a[i], _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2)));
+			a[i] = _mm_add_epi64(a[i], product);
+		}
+	}
+	for (int i = 0; i < 4; i++)
+		_mm_store_si128((__m128i *)acc + i, a[i]);
+}
+
+static void scramble(std::uint64_t (&acc)[lanes]){
+	const auto prime = _mm_set1_epi32((int)prime32_1);
+	for (int i = 0; i < 4; i++){
+		auto a = _mm_load_si128((const __m128i *)acc + i);
+		a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+		a = _mm_xor_si128(a, _mm_load_si128((const __m128i *)secret + i));
+		auto lo = _mm_mul_epu32(a, prime);
+		auto hi = _mm_mul_epu32(_mm_srli_epi64(a, 32), prime);
+		_mm_store_si128((__m128i *)acc + i, _mm_add_epi64(lo, _mm_slli_epi64(hi, 32)));
+	}
+}
+#else
+static void accumulate(std::uint64_t (&acc)[lanes], const byte_t *p, size_t stripes){
+	for (size_t s = 0; s < stripes; s++, p += stripe_size){
+		for (int i = 0; i < lanes; i++){
+			auto data = read_u64(p + i * sizeof(std::uint64_t));
+			auto key = data ^ secret[i];
+			acc[i ^ 1] += data;
+			acc[i] += (key & 0xFFFFFFFF) * (key >> 32);
+		}
+	}
+}
+
+static void scramble(std::uint64_t (&acc)[lanes]){
+	for (int i = 0; i < lanes; i++){
+		auto a = acc[i];
+		a ^= a >> 47;
+		a ^= secret[i];
+		acc[i] = a * prime32_1;
+	}
+}
+#endif
+
+std::uint64_t hash_frame(const void *data, size_t size){
+	auto p = (const byte_t *)data;
+	alignas(32) std::uint64_t acc[lanes] = {
+		prime32_1, prime64_1, prime64_2, prime64_3,
+		prime64_4, prime32_1 ^ prime64_5, prime64_2 ^ prime64_1, prime64_1 + prime64_2,
+	};
+
+	const size_t stripes = size / stripe_size;
+	for (size_t i = 0; i < stripes; i += stripes_per_block){
+		auto n = std::min(stripes - i, stripes_per_block);
+		accumulate(acc, p + i * stripe_size, n);
+		if (n == stripes_per_block)
+			scramble(acc);
+	}
+	p += stripes * stripe_size;
+	size -= stripes * stripe_size;
+
+	std::uint64_t ret = (std::uint64_t)stripes * stripe_size * prime64_1;
+	for (auto a : acc)
+		ret = rotl(ret ^ (a * prime64_2), 31) * prime64_1;
+	for (; size >= 8; size -= 8, p += 8){
+		ret ^= rotl(read_u64(p) * prime64_2, 31) * prime64_1;
+		ret = rotl(ret, 27) * prime64_1 + prime64_4;
+	}
+	for (; size; size--, p++){
+		ret ^= *p * prime64_5;
+		ret = rotl(ret, 11) * prime64_1;
+	}
+
+	ret ^= ret >> 33;
+	ret *= prime64_2;
+	ret ^= ret >> 29;
+	ret *= prime64_3;
+	ret ^= ret >> 32;
+	return ret;
+}
+
+FrameHashWriter::FrameHashWriter(const std::string &path, int width, int height): file(path, std::ios::binary){
+	if (!this->file)
+		throw std::runtime_error("Can't open frame hash stream: " + path);
+	std::uint8_t header[frame_hash_stream_header_size];
+	memcpy(header, frame_hash_stream_magic, sizeof(frame_hash_stream_magic));
+	write_le(header + 8, width, 4);
+	write_le(header + 12, height, 4);
+	this->file.write((const char *)header, sizeof(header));
+}
+
+void FrameHashWriter::write(std::uint64_t hash){
+	std::uint8_t buffer[8];
+	write_le(buffer, hash, 8);
+	this->file.write((const char *)buffer, sizeof(buffer));
+}
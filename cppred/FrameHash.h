@@ -0,0 +1,18 @@
+#pragma once
+
+#include "utility.h"
+#include <fstream>
+#include <string>
+
+//Fast 64-bit hash for frame buffers. Built like the long input loop of XXH3:
+//eight 64-bit lanes that accumulate 32x32->64 bit products, which map directly
+//to SSE2 and AVX2 instructions. Every code path computes the same value.
+std::uint64_t hash_frame(const void *data, size_t size);
+
+//Writes a frame hash stream (see common/FrameHashStream.h).
+class FrameHashWriter{
+	std::ofstream file;
+public:
+	FrameHashWriter(const std::string &path, int width, int height);
+	void write(std::uint64_t hash);
+};
@@ -1,7 +1,7 @@
 #include "HeliosRenderer.h"
 #include "AudioDevice.h"
 #include "utility.h"
-#include <sstream>
+#include <algorithm>
 
 #define CHANNEL_SELECTION 0xF
 #define CHANNEL1 (1 << 0)
@@ -23,44 +23,35 @@ basic_StereoSample<std::int16_t> convert(const basic_StereoSample<intermediate_a
 #endif
 }
 
-HeliosRenderer::HeliosRenderer(AudioDevice &dev):
+HeliosRenderer::HeliosRenderer(AudioDevice &dev, const AudioBufferOptions &options):
 		AudioRenderer(dev),
+		frame_length(std::max(std::min(options.frame_length, (unsigned)AudioFrame::max_length), 1U)),
 #ifdef USE_STD_FUNCTION
-		audio_sample_clock(gb_cpu_frequency_power, sampling_frequency, [this](std::uint64_t n){ this->sample_callback(n); }),
-		frame_sequencer_clock(gb_cpu_frequency_power, 512, [this](std::uint64_t n){ this->frame_sequencer_callback(n); })
+		audio_sample_clock(gb_cpu_frequency_power, synthesis_frequency, [this](std::uint64_t n){ this->sample_callback(n); }),
+		frame_sequencer_clock(gb_cpu_frequency_power, 512, [this](std::uint64_t n){ this->frame_sequencer_callback(n); }),
 #else
-		audio_sample_clock(gb_cpu_frequency_power, sampling_frequency, sample_callback, this),
-		frame_sequencer_clock(gb_cpu_frequency_power, 512, frame_sequencer_callback, this)
+		audio_sample_clock(gb_cpu_frequency_power, synthesis_frequency, sample_callback, this),
+		frame_sequencer_clock(gb_cpu_frequency_power, 512, frame_sequencer_callback, this),
 #endif
+		channels(this->square1, this->square2, this->wave, this->noise),
+		publishing_frames(std::max(options.queue_depth, 1U)),
+		resampler(synthesis_frequency, dev.get_frequency())
 {
-#ifdef OUTPUT_AUDIO_TO_FILE
-	this->output_file.reset(new std::ofstream("output-0.raw", std::ios::binary));
-	bool abort = false;
-	if (*this->output_file){
-		int i = 0;
-		for (auto &file : this->output_files_by_channel){
-			std::stringstream stream;
-			stream << "output-" << i + 1 << ".raw";
-			file.reset(new std::ofstream(stream.str().c_str(), std::ios::binary));
-			if (!*file){
-				abort = true;
-				break;
-			}
-			this->output_buffers_by_channel[i].reset(new AudioFrame);
-			i++;
-		}
-	} else
-		abort = true;
-	if (abort){
-		this->output_file.reset();
-		for (auto &file : this->output_files_by_channel)
-			file.reset();
-		for (auto &buffer : this->output_buffers_by_channel)
-			buffer.reset();
+	if (!this->resampler.is_passthrough()){
+		this->synthesis_frame.reset(new AudioFrame());
+		this->resampled.reserve(AudioFrame::max_length);
 	}
+	this->initialize_new_frame();
+#ifdef USE_BAND_LIMITED_SYNTHESIS
+	for (auto &level : this->channel_levels)
+		level.left = level.right = 0;
 #endif
 }
 
+HeliosRenderer::~HeliosRenderer(){
+	this->set_recorder(nullptr);
+}
+
 void HeliosRenderer::update(double now){
 	this->current_clock = cast_round_u64(now * gb_cpu_frequency);
 	if (this->set_audio_turned_on_at_at_next_update){
@@ -68,21 +59,99 @@ void HeliosRenderer::update(double now){
 		this->set_audio_turned_on_at_at_next_update = false;
 	}
 	auto t = this->current_clock - this->audio_turned_on_at;
-	std::uint64_t i, loops;
 	if (t < this->last_simulated_time){
-		i = t - t % 4;
-		loops = 1;
-	}else{
-		i = this->last_simulated_time;
-		loops = (t - i) / 4;
-	}
-
-	for (std::uint64_t j = 0; j < loops; j++, i += 4){
-		this->noise.update_state_before_render(i);
+		auto i = t - t % 4;
+#ifndef USE_BAND_LIMITED_SYNTHESIS
+		this->noise.update_lfsr(i);
+#endif
 		this->frame_sequencer_clock.update(i);
 		this->audio_sample_clock.update(i);
+#ifdef USE_BAND_LIMITED_SYNTHESIS
+		this->render_pending_samples();
+#endif
+		this->last_simulated_time = i + 4;
+		this->schedule_sequencer(i);
+		return;
+	}
+
+	auto i = this->last_simulated_time;
+	auto end = t - (t - i) % 4;
+	if (i == end)
+		return;
+
+#ifdef USE_BAND_LIMITED_SYNTHESIS
+	//Between frame sequencer and sequencer ticks the channels only change on
+	//their own, so all the samples in between are rendered as a single run.
+	while (true){
+		auto next = std::min(this->frame_sequencer_clock.next_update(i), this->next_sequencer_tick);
+		if (next >= end)
+			break;
+		next = (next + 3) & ~(std::uint64_t)3;
+		if (next >= end)
+			break;
+		if (next > i){
+			this->audio_sample_clock.update(next - 4);
+			this->render_pending_samples();
+		}
+		this->run_sequencer(next);
+		this->frame_sequencer_clock.update(next);
+		i = next + 4;
+	}
+	this->audio_sample_clock.update(end - 4);
+	this->render_pending_samples();
+#else
+	//The simulation advances in steps of 4 cycles, but most steps don't
+	//trigger any clock, so jump directly from one event to the next. The LFSR
+	//only needs to be up to date when a sample is rendered or a register is
+	//written, so it's caught up at the first step, before every event, and at
+	//the last step.
+	this->noise.update_lfsr(i);
+	while (true){
+		auto next = std::min(this->frame_sequencer_clock.next_update(i), this->audio_sample_clock.next_update(i));
+		next = std::min(next, this->next_sequencer_tick);
+		if (next >= end)
+			break;
+		next = (next + 3) & ~(std::uint64_t)3;
+		if (next >= end)
+			break;
+		this->noise.update_lfsr(next);
+		this->run_sequencer(next);
+		//If the sequencer reconfigured the LFSR, it restarts here, as it would
+		//at the start of the next update.
+		this->noise.update_lfsr(next);
+		this->frame_sequencer_clock.update(next);
+		this->audio_sample_clock.update(next);
+		i = next + 4;
+	}
+	this->noise.update_lfsr(end - 4);
+#endif
+	this->last_simulated_time = end;
+}
+
+void HeliosRenderer::set_sequencer(AudioSequencer *sequencer){
+	this->sequencer = sequencer;
+	if (this->last_simulated_time != std::numeric_limits<std::uint64_t>::max())
+		this->schedule_sequencer(this->last_simulated_time);
+	else
+		//Scheduled by the first update.
+		this->next_sequencer_tick = std::numeric_limits<std::uint64_t>::max();
+}
+
+void HeliosRenderer::schedule_sequencer(std::uint64_t now){
+	if (this->sequencer)
+		this->next_sequencer_tick = now + sequencer_period;
+	else
+		this->next_sequencer_tick = std::numeric_limits<std::uint64_t>::max();
+}
+
+//Register writes made by the sequencer take effect at clock, just like writes
+//made between two calls to update() take effect at the start of the next one.
+void HeliosRenderer::run_sequencer(std::uint64_t clock){
+	while (clock >= this->next_sequencer_tick){
+		auto time = (double)(this->next_sequencer_tick + this->audio_turned_on_at) / gb_cpu_frequency;
+		this->next_sequencer_tick += sequencer_period;
+		this->sequencer->sequencer_tick(time);
 	}
-	this->last_simulated_time = i;
 }
 
 void HeliosRenderer::sample_callback(void *This, std::uint64_t sample_no){
@@ -94,9 +163,15 @@ void HeliosRenderer::frame_sequencer_callback(void *This, std::uint64_t clock){
 }
 
 void HeliosRenderer::sample_callback(std::uint64_t sample_no){
-	StereoSampleFinal *buffer = this->publishing_frames.get_private_resource()->buffer;
+#ifdef USE_BAND_LIMITED_SYNTHESIS
+	if (!this->pending_samples)
+		this->first_pending_sample = sample_no;
+	this->pending_samples++;
+#else
+	StereoSampleFinal *buffer = this->get_synthesis_buffer();
 	this->last_sample = this->compute_sample();
 	this->write_sample(buffer);
+#endif
 }
 
 void HeliosRenderer::frame_sequencer_callback(std::uint64_t clock){
@@ -120,19 +195,16 @@ StereoSampleFinal HeliosRenderer::compute_sample(){
 	}
 
 	StereoSampleIntermediate channels[4];
-	channels[0] = this->render_square1(sample_no);
-	channels[1] = this->render_square2(sample_no);
-	channels[2] = this->render_voluntary(sample_no);
-	channels[3] = this->render_noise(sample_no);
+	this->channels.render(sample_no, this->stereo_panning, channels);
 
 	StereoSampleIntermediate sample;
 	sample.left = sample.right = 0;
 
 	for (int i = 4; i--;){
-#ifdef OUTPUT_AUDIO_TO_FILE
-		if (this->output_buffers_by_channel[i])
-			this->output_buffers_by_channel[i]->buffer[this->current_frame_position] = convert(channels[i]);
-#endif
+		if (!(CHANNEL_SELECTION & (1 << i)))
+			channels[i].left = channels[i].right = 0;
+		if (this->recorder_block && this->recorder->has_stems())
+			this->recorder_block->channels[i][this->current_frame_position] = convert(channels[i]);
 		sample += channels[i];
 	}
 	sample /= 4;
@@ -148,85 +220,166 @@ StereoSampleFinal HeliosRenderer::compute_sample(){
 
 void HeliosRenderer::write_sample(StereoSampleFinal *&buffer){
 	buffer[this->current_frame_position++] = this->last_sample;
-	if (this->current_frame_position >= AudioFrame::length){
-#ifdef OUTPUT_AUDIO_TO_FILE
-		if (this->output_file)
-			this->output_file->write((const char *)buffer, AudioFrame::length * sizeof(StereoSampleFinal));
-		for (int i = 4; i--;){
-			auto &buffer2 = this->output_buffers_by_channel[i]->buffer;
-			if (this->output_files_by_channel[i])
-				this->output_files_by_channel[i]->write((const char *)buffer2, sizeof(buffer2));
-		}
-#endif
+	if (this->current_frame_position >= this->frame_length){
 		this->current_frame_position = 0;
-		this->publishing_frames.publish();
-		this->initialize_new_frame();
-		buffer = this->publishing_frames.get_private_resource()->buffer;
+		this->publish_frame();
+		buffer = this->get_synthesis_buffer();
 	}
 }
 
-void HeliosRenderer::initialize_new_frame(){
-	auto frame = this->publishing_frames.get_private_resource();
-	frame->frame_no = this->frame_no++;
-	auto &buffer = frame->buffer;
-	memset(buffer, 0, sizeof(buffer));
+StereoSampleFinal *HeliosRenderer::get_synthesis_buffer(){
+	if (this->synthesis_frame)
+		return this->synthesis_frame->buffer;
+	return this->publishing_frames.get_private_resource()->buffer;
 }
 
-template <typename T1, typename T2>
-StereoSampleIntermediate compute_channel_panning_and_silence(const T1 &generator, std::uint64_t time, const T2 &pan){
-	StereoSampleIntermediate ret;
-	if (!!pan.either){
-		auto value = generator.render(time);
-
-		ret.left = value * !!pan.left;
-		ret.right = value * !!pan.right;
-	}else
-		ret.left = ret.right = 0;
-
-	return ret;
+void HeliosRenderer::publish_frame(){
+	auto buffer = this->get_synthesis_buffer();
+	this->mix_cached_samples((this->synthesized_frames + 1) * this->frame_length);
+	this->synthesized_frames++;
+	if (this->capture)
+		this->capture->insert(this->capture->end(), buffer, buffer + this->frame_length);
+	if (this->recorder_block){
+		memcpy(this->recorder_block->mix, buffer, this->frame_length * sizeof(StereoSampleFinal));
+		this->recorder_block->length = this->frame_length;
+		this->recorder->submit(this->recorder_block);
+		this->recorder_block = this->recorder->get_block();
+	}
+	if (!this->synthesis_frame){
+		this->publish_output_frame();
+		return;
+	}
+	this->resampled.clear();
+	this->resampler.process(buffer, this->frame_length, this->resampled);
+	size_t i = 0;
+	while (i < this->resampled.size()){
+		auto n = std::min<size_t>(this->resampled.size() - i, this->frame_length - this->output_position);
+		auto dst = this->publishing_frames.get_private_resource()->buffer + this->output_position;
+		memcpy(dst, &this->resampled[i], n * sizeof(StereoSampleFinal));
+		i += n;
+		this->output_position += (unsigned)n;
+		if (this->output_position >= this->frame_length){
+			this->output_position = 0;
+			this->publish_output_frame();
+		}
+	}
+	memset(buffer, 0, this->frame_length * sizeof(StereoSampleFinal));
+}
+
+#ifdef USE_BAND_LIMITED_SYNTHESIS
+void HeliosRenderer::render_pending_samples(){
+	while (this->pending_samples){
+		auto n = (unsigned)std::min<std::uint64_t>(this->pending_samples, this->frame_length - this->current_frame_position);
+		this->render_run(n);
+		this->pending_samples -= n;
+		this->first_pending_sample += n;
+		if (this->current_frame_position >= this->frame_length){
+			this->finish_segment();
+			this->blep_left.next_frame(this->frame_length);
+			this->blep_right.next_frame(this->frame_length);
+			this->integrated_position = 0;
+			this->current_frame_position = 0;
+			this->publish_frame();
+		}
+	}
 }
 
-StereoSampleIntermediate HeliosRenderer::render_square1(std::uint64_t time){
-	this->square1.update_state_before_render(time);
+void HeliosRenderer::render_run(unsigned samples){
+	if (this->master_toggle){
+		auto start = this->current_frame_position << blep_phase_bits;
 #if CHANNEL_SELECTION & CHANNEL1
-	return compute_channel_panning_and_silence(this->square1, time, this->stereo_panning[0]);
-#else
-	StereoSampleIntermediate ret;
-	ret.left = ret.right = 0;
-	return ret;
+		this->square1.render_steps(samples, [this, start](unsigned offset, intermediate_audio_type level){
+			this->add_step(0, start + offset, level);
+		});
 #endif
-}
-
-StereoSampleIntermediate HeliosRenderer::render_square2(std::uint64_t time){
-	this->square2.update_state_before_render(time);
 #if CHANNEL_SELECTION & CHANNEL2
-	return compute_channel_panning_and_silence(this->square2, time, this->stereo_panning[1]);
-#else
-	StereoSampleIntermediate ret;
-	ret.left = ret.right = 0;
-	return ret;
+		this->square2.render_steps(samples, [this, start](unsigned offset, intermediate_audio_type level){
+			this->add_step(1, start + offset, level);
+		});
 #endif
-}
-
-StereoSampleIntermediate HeliosRenderer::render_voluntary(std::uint64_t time){
-	this->wave.update_state_before_render(time);
 #if CHANNEL_SELECTION & CHANNEL3
-	return compute_channel_panning_and_silence(this->wave, time, this->stereo_panning[2]);
-#else
-	StereoSampleIntermediate ret;
-	ret.left = ret.right = 0;
-	return ret;
+		this->wave.render_steps(samples, [this, start](unsigned offset, intermediate_audio_type level){
+			this->add_step(2, start + offset, level);
+		});
+#endif
+#if CHANNEL_SELECTION & CHANNEL4
+		this->noise.render_steps(this->first_pending_sample, samples, [this, start](unsigned offset, intermediate_audio_type level){
+			this->add_step(3, start + offset, level);
+		});
 #endif
+	}
+	this->current_frame_position += samples;
 }
 
-StereoSampleIntermediate HeliosRenderer::render_noise(std::uint64_t time){
-#if CHANNEL_SELECTION & CHANNEL4
-	return compute_channel_panning_and_silence(this->noise, time, this->stereo_panning[3]);
+void HeliosRenderer::add_step(int channel, unsigned time, intermediate_audio_type level){
+	auto &pan = this->stereo_panning[channel];
+	auto &last = this->channel_levels[channel];
+	auto left = level * !!pan.left;
+	auto right = level * !!pan.right;
+	if (left != last.left){
+		this->blep_left.add_delta(time, left - last.left);
+		last.left = left;
+	}
+	if (right != last.right){
+		this->blep_right.add_delta(time, right - last.right);
+		last.right = right;
+	}
+}
+
+//Mixes the samples rendered since the last call into the current frame, using
+//the current master settings.
+void HeliosRenderer::finish_segment(){
+	auto begin = this->integrated_position;
+	auto end = this->current_frame_position;
+	if (begin == end)
+		return;
+	this->integrated_position = end;
+	this->blep_left.integrate(this->mix_left, begin, end);
+	this->blep_right.integrate(this->mix_right, begin, end);
+
+	auto buffer = this->get_synthesis_buffer();
+	if (!this->master_toggle){
+		for (auto i = begin; i < end; i++)
+			buffer[i].left = buffer[i].right = 0;
+		return;
+	}
+#ifdef USE_FLOAT_AUDIO
+	const intermediate_audio_type max = 1;
 #else
-	StereoSampleIntermediate ret;
-	ret.left = ret.right = 0;
-	return ret;
+	const intermediate_audio_type max = (1 << 15) - 1;
+#endif
+	for (auto i = begin; i < end; i++){
+		StereoSampleIntermediate sample;
+		sample.left = this->mix_left[i];
+		sample.right = this->mix_right[i];
+		sample /= 4;
+		sample.left = this->filter_left.update(sample.left);
+		sample.right = this->filter_right.update(sample.right);
+
+		sample.left *= this->left_volume;
+		sample.right *= this->right_volume;
+		sample /= 15;
+		//The ringing of the steps can overshoot.
+		sample.left = std::max(std::min(sample.left, max), -max);
+		sample.right = std::max(std::min(sample.right, max), -max);
+
+		buffer[i] = convert(sample);
+	}
+}
 #endif
+
+//Queues the private frame for the device and starts the next one.
+void HeliosRenderer::publish_output_frame(){
+	this->publishing_frames.get_private_resource()->publish_time = this->clock.get();
+	this->stats.record_published_frame(!this->publishing_frames.publish());
+	this->initialize_new_frame();
+}
+
+void HeliosRenderer::initialize_new_frame(){
+	auto frame = this->publishing_frames.get_private_resource();
+	frame->frame_no = this->frame_no++;
+	frame->length = this->frame_length;
+	memset(frame->buffer, 0, this->frame_length * sizeof(StereoSampleFinal));
 }
 
 void HeliosRenderer::length_counter_event(){
@@ -317,6 +470,9 @@ void HeliosRenderer::set_NR44(byte_t value){
 }
 
 void HeliosRenderer::set_NR50(byte_t value){
+#ifdef USE_BAND_LIMITED_SYNTHESIS
+	this->finish_segment();
+#endif
 	this->NR50 = value;
 
 	this->left_volume = (value >> 4) & 0x07;
@@ -335,6 +491,10 @@ void HeliosRenderer::set_NR51(byte_t value){
 }
 
 void HeliosRenderer::set_NR52(byte_t value){
+#ifdef USE_BAND_LIMITED_SYNTHESIS
+	this->finish_segment();
+#endif
+	this->mix_cached_samples(this->get_synthesis_position());
 	auto mt = this->master_toggle;
 	this->master_toggle = !!(value & bit(7));
 	if (this->master_toggle & !mt){
@@ -434,3 +594,82 @@ AudioFrame *HeliosRenderer::get_current_frame(){
 void HeliosRenderer::return_used_frame(AudioFrame *frame){
 	this->publishing_frames.return_resource(frame);
 }
+
+void HeliosRenderer::mix_cached_sound(const AudioCache::Entry *sound){
+	//The sound being replaced plays up to this point.
+#ifdef USE_BAND_LIMITED_SYNTHESIS
+	this->finish_segment();
+#endif
+	auto now = this->get_synthesis_position();
+	this->mix_cached_samples(now);
+	this->cached_sound = sound;
+	this->cached_sound_start = now;
+	this->cached_sound_position = now;
+}
+
+bool HeliosRenderer::is_silent(){
+	if (this->cached_sound)
+		return false;
+	if (this->square1.is_active() || this->square2.is_active() || this->wave.is_active() || this->noise.is_active())
+		return false;
+#ifdef USE_BAND_LIMITED_SYNTHESIS
+	//The filters are updated as the steps are integrated.
+	this->finish_segment();
+	for (auto &level : this->channel_levels)
+		if (level.left || level.right)
+			return false;
+	if (!this->blep_left.is_silent(this->integrated_position, this->frame_length) || !this->blep_right.is_silent(this->integrated_position, this->frame_length))
+		return false;
+#endif
+	return this->filter_left.is_discharged() && this->filter_right.is_discharged();
+}
+
+static std::int16_t saturate(int x){
+	return (std::int16_t)std::max(std::min(x, (int)int16_max), -int16_max - 1);
+}
+
+//Adds the cached sound to the current frame, from where it was left up to
+//position end of the synthesis timeline. The live output must be final up to
+//end. Like the channels, the sound is muted while the master switch is off.
+void HeliosRenderer::mix_cached_samples(std::uint64_t end){
+	if (!this->cached_sound)
+		return;
+	auto &samples = this->cached_sound->samples;
+	auto sound_end = this->cached_sound_start + samples.size();
+	end = std::min(end, sound_end);
+	if (this->master_toggle){
+		auto buffer = this->get_synthesis_buffer();
+		auto frame_start = this->synthesized_frames * this->frame_length;
+		for (auto i = this->cached_sound_position; i < end; i++){
+			auto &dst = buffer[i - frame_start];
+			auto &src = samples[i - this->cached_sound_start];
+			dst.left = saturate(dst.left + src.left);
+			dst.right = saturate(dst.right + src.right);
+		}
+	}
+	this->cached_sound_position = std::max(this->cached_sound_position, end);
+	if (this->cached_sound_position >= sound_end)
+		this->cached_sound = nullptr;
+}
+
+void HeliosRenderer::set_recorder(AudioRecorder *recorder){
+#ifdef USE_BAND_LIMITED_SYNTHESIS
+	if (recorder && recorder->has_stems())
+		throw std::runtime_error("Per-channel stems can't be recorded with band-limited synthesis.");
+#endif
+	if (this->recorder_block){
+		//Save the part of the current frame that has already been rendered.
+		auto buffer = this->get_synthesis_buffer();
+		memcpy(this->recorder_block->mix, buffer, this->current_frame_position * sizeof(StereoSampleFinal));
+		this->recorder_block->length = this->current_frame_position;
+		this->recorder->submit(this->recorder_block);
+		this->recorder_block = nullptr;
+	}
+	this->recorder = recorder;
+	if (recorder)
+		this->recorder_block = recorder->get_block();
+}
+
+size_t HeliosRenderer::get_queued_frames(){
+	return this->publishing_frames.size();
+}
@@ -1,13 +1,20 @@
 #pragma once
 #include "AudioRenderer.h"
+#include "AudioRecorder.h"
+#include "Resampler.h"
 
 class HeliosRenderer : public AudioRenderer{
+	unsigned frame_length;
 	unsigned current_frame_position = 0;
 	std::uint64_t frame_no = 0;
 	std::uint64_t audio_turned_on_at = 0;
 	bool set_audio_turned_on_at_at_next_update = false;
 	std::uint64_t current_clock = 0;
 	std::uint64_t last_simulated_time = std::numeric_limits<std::uint64_t>::max();
+	AudioSequencer *sequencer = nullptr;
+	//Simulated time of the next sequencer tick. Never reached if there's no
+	//sequencer.
+	std::uint64_t next_sequencer_tick = std::numeric_limits<std::uint64_t>::max();
 
 	ClockDivider audio_sample_clock,
 		frame_sequencer_clock;
@@ -27,16 +34,43 @@ class HeliosRenderer : public AudioRenderer{
 	std::uint64_t speed_counter_b = 0;
 	std::uint64_t internal_sample_counter = 0;
 	StereoSampleFinal last_sample;
-#ifdef OUTPUT_AUDIO_TO_FILE
-	std::unique_ptr<std::ofstream> output_file;
-	std::unique_ptr<std::ofstream> output_files_by_channel[4];
-	std::unique_ptr<AudioFrame> output_buffers_by_channel[4];
+#ifdef USE_BAND_LIMITED_SYNTHESIS
+	BlepBuffer blep_left,
+		blep_right;
+	//Last level of each channel that was added to the BlepBuffers.
+	StereoSampleIntermediate channel_levels[4];
+	intermediate_audio_type mix_left[AudioFrame::max_length],
+		mix_right[AudioFrame::max_length];
+	//Samples before this position of the current frame have been written.
+	unsigned integrated_position = 0;
+	std::uint64_t pending_samples = 0;
+	std::uint64_t first_pending_sample = 0;
 #endif
+	AudioRecorder *recorder = nullptr;
+	//Block receiving the current frame. Stems are only filled when
+	//point-sampling.
+	AudioRecorder::Block *recorder_block = nullptr;
 	Square1Generator square1;
 	Square2Generator square2;
 	VoluntaryWaveGenerator wave;
 	NoiseGenerator noise;
+	StandardChannelPipeline channels;
 	QueuedPublishingResource<AudioFrame> publishing_frames;
+	Resampler resampler;
+	//Frame being synthesized when the device runs at a different rate.
+	//Otherwise, samples are synthesized directly into the private frame.
+	std::unique_ptr<AudioFrame> synthesis_frame;
+	std::vector<StereoSampleFinal> resampled;
+	//Position in the private frame of the next resampled sample.
+	unsigned output_position = 0;
+	//Synthesis frames published so far.
+	std::uint64_t synthesized_frames = 0;
+	std::vector<StereoSampleFinal> *capture = nullptr;
+	const AudioCache::Entry *cached_sound = nullptr;
+	//Synthesis position of the first sample of cached_sound.
+	std::uint64_t cached_sound_start = 0;
+	//Synthesis position up to which cached_sound has been mixed.
+	std::uint64_t cached_sound_position = 0;
 
 	static void sample_callback(void *, std::uint64_t);
 	static void frame_sequencer_callback(void *, std::uint64_t);
@@ -45,15 +79,24 @@ class HeliosRenderer : public AudioRenderer{
 	StereoSampleFinal compute_sample();
 	void write_sample(StereoSampleFinal *&buffer);
 	void initialize_new_frame();
-	StereoSampleIntermediate render_square1(std::uint64_t time);
-	StereoSampleIntermediate render_square2(std::uint64_t time);
-	StereoSampleIntermediate render_voluntary(std::uint64_t time);
-	StereoSampleIntermediate render_noise(std::uint64_t time);
+	void schedule_sequencer(std::uint64_t now);
+	void run_sequencer(std::uint64_t clock);
+	StereoSampleFinal *get_synthesis_buffer();
+	void publish_frame();
+	void publish_output_frame();
+	void mix_cached_samples(std::uint64_t end);
+#ifdef USE_BAND_LIMITED_SYNTHESIS
+	void render_pending_samples();
+	void render_run(unsigned samples);
+	void add_step(int channel, unsigned time, intermediate_audio_type level);
+	void finish_segment();
+#endif
 	void length_counter_event();
 	void volume_event();
 	void sweep_event();
 public:
-	HeliosRenderer(AudioDevice &);
+	HeliosRenderer(AudioDevice &, const AudioBufferOptions & = AudioBufferOptions());
+	~HeliosRenderer();
 	void update(double now) override;
 
 	void set_NR10(byte_t) override;
@@ -101,7 +144,24 @@ public:
 	}
 	byte_t get_NR52() const override;
 	void copy_voluntary_wave(const void *buffer) override;
+	void set_sequencer(AudioSequencer *) override;
+	void mix_cached_sound(const AudioCache::Entry *) override;
+	bool is_silent() override;
 
 	AudioFrame *get_current_frame() override;
 	void return_used_frame(AudioFrame *frame) override;
+	size_t get_queued_frames() override;
+	//Every frame published from now on is also submitted to recorder. Pass
+	//nullptr to stop recording. The recorder must outlive the renderer, or
+	//recording must be stopped first.
+	void set_recorder(AudioRecorder *recorder);
+	//Every synthesis frame, at synthesis_frequency, is also appended to
+	//capture. Pass nullptr to stop.
+	void set_capture(std::vector<StereoSampleFinal> *capture){
+		this->capture = capture;
+	}
+	//Number of samples synthesized so far, at synthesis_frequency.
+	std::uint64_t get_synthesis_position() const{
+		return this->synthesized_frames * this->frame_length + this->current_frame_position;
+	}
 };
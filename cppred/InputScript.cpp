@@ -0,0 +1,95 @@
+#include "InputScript.h"
+#include <sstream>
+#include <stdexcept>
+
+static const struct{
+	const char *name;
+	byte_t mask;
+} button_names[] = {
+	{ "a",      InputState::mask_a      },
+	{ "b",      InputState::mask_b      },
+	{ "start",  InputState::mask_start  },
+	{ "select", InputState::mask_select },
+	{ "up",     InputState::mask_up     },
+	{ "down",   InputState::mask_down   },
+	{ "left",   InputState::mask_left   },
+	{ "right",  InputState::mask_right  },
+};
+
+static InputState parse_buttons(const std::string &s){
+	InputState ret;
+	if (s == "none")
+		return ret;
+	byte_t value = 0;
+	size_t begin = 0;
+	while (true){
+		auto end = s.find('+', begin);
+		auto name = s.substr(begin, end - begin);
+		bool found = false;
+		for (auto &button : button_names){
+			if (name == button.name){
+				value |= button.mask;
+				found = true;
+				break;
+			}
+		}
+		if (!found)
+			throw std::runtime_error("Unknown button in input script: " + name);
+		if (end == s.npos)
+			break;
+		begin = end + 1;
+	}
+	ret.set_value(value);
+	return ret;
+}
+
+static std::string buttons_to_string(const InputState &state){
+	std::string ret;
+	for (auto &button : button_names){
+		if (!(state.get_value() & button.mask))
+			continue;
+		if (ret.size())
+			ret += '+';
+		ret += button.name;
+	}
+	if (!ret.size())
+		ret = "none";
+	return ret;
+}
+
+InputScript::InputScript(const std::string &path){
+	std::ifstream file(path);
+	if (!file)
+		throw std::runtime_error("Can't open input script: " + path);
+	std::string line;
+	while (std::getline(file, line)){
+		if (!line.size() || line[0] == '#' || line[0] == '\r')
+			continue;
+		std::stringstream stream(line);
+		std::uint64_t frame;
+		std::string buttons;
+		if (!(stream >> frame >> buttons))
+			throw std::runtime_error("Invalid line in input script: " + line);
+		if (this->changes.size() && frame < this->changes.back().first)
+			throw std::runtime_error("Input script is not sorted by frame: " + line);
+		this->changes.emplace_back(frame, parse_buttons(buttons));
+	}
+}
+
+InputState InputScript::get_state(std::uint64_t frame){
+	for (; this->next_change < this->changes.size() && this->changes[this->next_change].first <= frame; this->next_change++)
+		this->state = this->changes[this->next_change].second;
+	return this->state;
+}
+
+InputRecorder::InputRecorder(const std::string &path): file(path){
+	if (!this->file)
+		throw std::runtime_error("Can't open file to record input: " + path);
+}
+
+void InputRecorder::record(std::uint64_t frame, const InputState &state){
+	if (state == this->last_state)
+		return;
+	this->last_state = state;
+	this->file << frame << ' ' << buttons_to_string(state) << std::endl;
+}
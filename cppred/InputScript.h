@@ -0,0 +1,32 @@
+#pragma once
+
+#include "InputState.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+//Joypad states over time, for replaying a session. Stored as text, with one
+//line for every frame where the state changes:
+//
+//    <frame> <buttons>
+//
+//buttons is a list of a, b, start, select, up, down, left and right separated
+//by '+', or "none". Empty lines and lines that start with '#' are ignored.
+class InputScript{
+	std::vector<std::pair<std::uint64_t, InputState>> changes;
+	size_t next_change = 0;
+	InputState state;
+public:
+	InputScript(const std::string &path);
+	//Note: frame must never decrease from one call to the next.
+	InputState get_state(std::uint64_t frame);
+};
+
+//Writes an InputScript while a session is being played.
+class InputRecorder{
+	std::ofstream file;
+	InputState last_state;
+public:
+	InputRecorder(const std::string &path);
+	void record(std::uint64_t frame, const InputState &);
+};
@@ -0,0 +1,55 @@
+#include "OfflineAudio.h"
+#include "AudioDevice.h"
+#include "AudioRecorder.h"
+#include "HeliosRenderer.h"
+#include "CppRed/AudioProgram.h"
+#include "../CodeGeneration/output/audio.h"
+#include <stdexcept>
+
+//Same granularity as AudioScheduler.
+static const double render_step = 0.001;
+
+static void render_resource(AudioResourceId id, const std::string &path, const OfflineAudioOptions &options){
+	AudioDevice device(true);
+	AudioRecorder recorder(path, options.stems);
+	HeliosRenderer renderer(device, options.buffers);
+	CppRed::AudioProgram program(renderer, options.version);
+	renderer.set_recorder(&recorder);
+	renderer.set_NR52(0xFF);
+	renderer.set_NR50(0x77);
+	program.set_sample_accurate(options.sample_accurate);
+	{
+		auto lock = program.acquire_lock();
+		program.play_sound(id);
+	}
+	for (double t = 0; t < options.max_duration; t += render_step){
+		program.update(t);
+		renderer.update(t);
+		if (!program.get_playing())
+			break;
+	}
+	renderer.set_recorder(nullptr);
+}
+
+void render_audio_offline(const std::string &name, const std::string &path, const OfflineAudioOptions &options){
+	std::vector<std::string> names;
+	{
+		AudioDevice device(true);
+		HeliosRenderer renderer(device);
+		CppRed::AudioProgram program(renderer, options.version);
+		names = program.get_resource_strings();
+	}
+	if (name == "all"){
+		//Resource 0 is None.
+		for (size_t i = 1; i < names.size(); i++)
+			render_resource((AudioResourceId)i, path + "/" + names[i] + ".wav", options);
+		return;
+	}
+	for (size_t i = 1; i < names.size(); i++){
+		if (names[i] == name){
+			render_resource((AudioResourceId)i, path, options);
+			return;
+		}
+	}
+	throw std::runtime_error("Unknown audio resource: " + name);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "AudioData.h"
+#include "pokemon_version.h"
+#include <string>
+
+struct OfflineAudioOptions{
+	PokemonVersion version = PokemonVersion::Red;
+	AudioBufferOptions buffers;
+	//Also save each channel to its own file.
+	bool stems = false;
+	//See AudioProgram::set_sample_accurate().
+	bool sample_accurate = false;
+	//Music loops forever, so rendering stops after this many seconds even if
+	//the resource is still playing.
+	double max_duration = 300;
+};
+
+//Renders an audio resource to a WAV file, as fast as possible, by driving the
+//AudioProgram and the renderer with a virtual clock. Stops once every channel
+//has finished. If name is "all", every resource is rendered, and path is the
+//directory where the files are saved, named after the resources.
+void render_audio_offline(const std::string &name, const std::string &path, const OfflineAudioOptions &);
@@ -66,8 +66,12 @@ public:
 	}
 };
 
+//Single producer, single consumer. Both sides are wait-free: at most
+//capacity resources are ever queued, and the return queue has room for every
+//resource that can ever be allocated, so neither queue needs to grow.
 template <typename T>
 class QueuedPublishingResource{
+	size_t capacity;
 	std::vector<std::unique_ptr<T>> allocated;
 	moodycamel::ReaderWriterQueue<T *> return_queue;
 	//Invariant: private_resource is valid at all times.
@@ -85,16 +89,21 @@ class QueuedPublishingResource{
 		return this->allocated.back().get();
 	}
 public:
-	QueuedPublishingResource(){
+	QueuedPublishingResource(size_t max_capacity = 15):
+			capacity(max_capacity),
+			//Queued, plus the private resource, plus one held by the consumer.
+			return_queue(max_capacity + 2),
+			queue(max_capacity){
 		this->private_resource = this->allocate();
 	}
-	QueuedPublishingResource(size_t max_capacity): return_queue(max_capacity), queue(max_capacity){
-		this->private_resource = this->allocate();
-	}
-	void publish(){
-		if (!this->queue.try_enqueue(this->private_resource))
-			return;
+	//Returns false if the queue is full, in which case the private resource
+	//is kept.
+	bool publish(){
+		//The queue may have room for more than capacity elements.
+		if (this->queue.size_approx() >= this->capacity || !this->queue.try_enqueue(this->private_resource))
+			return false;
 		this->private_resource = this->reuse_or_allocate();
+		return true;
 	}
 	T *get_private_resource(){
 		return this->private_resource;
@@ -105,11 +114,15 @@ public:
 		return ret;
 	}
 	void return_resource(T *r){
-		this->return_queue.enqueue(r);
+		this->return_queue.try_enqueue(r);
+	}
+	//Approximate number of published resources not yet consumed.
+	size_t size() const{
+		return this->queue.size_approx();
 	}
 	void clear_public_resource(){
 		T *p;
 		while (this->queue.try_dequeue(p))
-			this->return_queue.enqueue(p);
+			this->return_queue.try_enqueue(p);
 	}
 };
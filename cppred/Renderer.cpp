@@ -4,43 +4,79 @@
 #include <cassert>
 #include <iostream>
 #include "Engine.h"
+#include "FrameHash.h"
+#if defined __AVX2__
+#include <immintrin.h>
+#elif defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#define USE_SSE2_FINAL_RENDER
+#include <emmintrin.h>
+#endif
 
 #include "../CodeGeneration/output/graphics_private.h"
 
 //#define MEASURE_RENDERING_TIMES
-#define ALWAYS_RENDER
+//#define ALWAYS_RENDER
+
+Renderer::Renderer(VideoDevice &device, Upscaler upscaler, unsigned render_threads):
+		device(&device),
+		upscaler(upscaler),
+		scale(1),
+		workers(render_threads){
+	if (upscaler != Upscaler::None){
+		this->scale = std::max(device.get_screen_size().x / logical_screen_width, 1);
+		if (upscaler == Upscaler::Scale2x && (this->scale < 2 || this->scale & (this->scale - 1)))
+			throw std::runtime_error("Scale2x requires a power of two scale.");
+		auto size = logical_screen_width * logical_screen_height * this->scale * this->scale;
+		this->upscaled_surfaces[0].resize(size);
+		if (upscaler == Upscaler::Scale2x && this->scale > 2)
+			this->upscaled_surfaces[1].resize(size);
+	}
 
-Renderer::Renderer(VideoDevice &device): device(&device){
-	this->main_texture = this->device->allocate_texture(logical_screen_width, logical_screen_height);
+	this->main_texture = this->device->allocate_texture(logical_screen_width * this->scale, logical_screen_height * this->scale);
 	if (!this->main_texture)
 		throw std::runtime_error("Failed to create main texture.");
 
 	TextureSurface surf;
 	if (this->main_texture.try_lock(surf))
-		memset(surf.get_row(0), 0xFF, logical_screen_height * logical_screen_width * sizeof(RGB));
+		memset(surf.get_row(0), 0xFF, this->main_texture.get_size().multiply_components() * sizeof(RGB));
 	this->initialize_assets();
 	this->initialize_data();
 }
 
-std::unique_ptr<VideoDevice> Renderer::initialize_device(int scale){
-	return std::make_unique<VideoDevice>(Point{ logical_screen_width, logical_screen_height } * scale);
+std::unique_ptr<VideoDevice> Renderer::initialize_device(int scale, bool headless){
+	return std::make_unique<VideoDevice>(Point{ logical_screen_width, logical_screen_height } * scale, headless);
 }
 
 void Renderer::initialize_assets(){
 	static_assert(packed_image_data_size * 4 % TileData::size == 0, "");
-	this->tile_data.resize(packed_image_data_size * 4 / TileData::size);
+	const size_t tile_count = packed_image_data_size * 4 / TileData::size;
+	this->tile_data.resize(tile_count * tile_flip_variants);
 
-	for (size_t i = 0; i < this->tile_data.size(); i++){
-		auto &tile = this->tile_data[i];
+	for (size_t i = 0; i < tile_count; i++){
+		auto tiles = &this->tile_data[i * tile_flip_variants];
+		auto &tile = tiles[0];
 		size_t offset = 0;
 		for (int y = 0; y < tile_size; y++){
 			int shift = 0;
 			for (int x = 0; x < tile_size; x++, offset++, shift = (shift + 2) % 8)
 				tile.data[offset] = (packed_image_data[(i * TileData::size + offset) / 4] >> shift) & BITMAP(00000011);
 		}
+		for (int flips = 1; flips < tile_flip_variants; flips++){
+			for (int y = 0; y < tile_size; y++){
+				int src_y = flips & 2 ? (tile_size - 1) - y : y;
+				for (int x = 0; x < tile_size; x++){
+					int src_x = flips & 1 ? (tile_size - 1) - x : x;
+					tiles[flips].data[x + y * tile_size] = tile.data[src_x + src_y * tile_size];
+				}
+			}
+		}
 	}
 }
 
+const Renderer::TileData &Renderer::get_tile_data(const Tile &tile) const{
+	return this->tile_data[tile_mapping[tile.tile_no] * tile_flip_variants + tile.flipped_x + tile.flipped_y * 2];
+}
+
 void Renderer::initialize_data(){
 	this->clear_screen();
 	this->bg_palette = null_palette;
@@ -54,14 +90,6 @@ void Renderer::initialize_data(){
 	this->set_palette(PaletteRegion::Sprites1, 0);
 }
 
-bool sort_sprites(Sprite *a, Sprite *b){
-	if (a->get_x() > b->get_x())
-		return true;
-	if (a->get_x() < b->get_x())
-		return false;
-	return a->get_id() < b->get_id();
-}
-
 void Renderer::do_software_rendering(){
 #ifdef MEASURE_RENDERING_TIMES
 	HighResolutionClock clock;
@@ -69,102 +97,112 @@ void Renderer::do_software_rendering(){
 #endif
 
 	TextureSurface surf;
-	if (!this->main_texture.try_lock(surf))
+	if (!this->main_texture.try_lock(surf)){
+		//The changes have already been recorded, so they would be lost.
+		this->force_full_redraw = true;
 		return;
-
-	for (auto &point : this->intermediate_render_surface){
-		point.value = -1;
-		point.palette = nullptr;
 	}
 
-	this->render_non_sprites();
-	this->render_sprites();
-	this->final_render(surf);
-	
+	this->prepare_sprites();
+
+	//Note: render_non_sprites() writes every point of the dirty lines of the
+	//intermediate surface, so they don't need to be cleared first. The rest of
+	//the surface still holds the last frame. The texture may not keep its
+	//contents while locked, so it's always resolved in full.
+	//Each band only writes its own lines. Only Scale2x reads lines from other
+	//bands, so it's the only case that needs to wait for all the bands before
+	//upscaling.
+	auto pixels = surf.get_row(0);
+	const bool single_pass = this->upscaler != Upscaler::Scale2x;
+	this->workers.run([this, pixels, single_pass](int band){
+		auto range = this->workers.get_band(band, logical_screen_height);
+		this->render_non_sprites(range.first, range.second);
+		this->render_sprites(range.first, range.second);
+		if (single_pass)
+			this->final_render(pixels, range.first, range.second);
+	});
+	if (!single_pass)
+		this->scale2x(pixels);
+	//Unchanged frames keep the hash of the last rendered frame.
+	if (this->compute_frame_hash)
+		this->frame_hash = hash_frame(pixels, this->main_texture.get_size().multiply_components() * sizeof(RGB));
+
 #ifdef MEASURE_RENDERING_TIMES
 	auto t1 = clock.get();
 	std::cout << "Rendering time: " << (t1 - t0) * 1000 << " ms\n";
 #endif
 }
 
-void Renderer::render_non_sprites(){
-	for (int y = 0; y < logical_screen_height; y++){
+void Renderer::render_non_sprites(int y0, int y1){
+	const RenderPoint empty = render_point_opaque;
+	for (int y = y0; y < y1; y++){
+		if (!this->dirty_lines[y])
+			continue;
+		auto row = this->intermediate_render_surface + y * logical_screen_width;
 		auto bg_offset = this->bg_global_offset + this->bg_offsets[y];
 		auto window_offset = this->window_global_offset + this->window_offsets[y];
 		auto wy_prime = y - window_offset.y;
 		bool window_enabled = this->enable_window && wy_prime >= 0 && wy_prime < logical_screen_height;
-		auto y_prime = wy_prime / tile_size * tilemap_width;
-		//if (window_enabled){
-		//	for (int x = 0; x < logical_screen_width; x++)
-		//		*(pixels++) = {0xFF,0x00,0x00,0xFF};
-		//	continue;
-		//}
-
-		for (int x = 0; x < logical_screen_width; x++){
-			auto &point = this->intermediate_render_surface[x + y * logical_screen_width];
-			auto &color_index = point.value;
-			auto &palette = point.palette;
-
-			color_index = -1;
-			palette = nullptr;
-
-			if (window_enabled){
-				auto p = window_offset;
-				p.x = euclidean_modulo(p.x, Tilemap::w * tile_size);
-				p.y = euclidean_modulo(p.y, Tilemap::h * tile_size);
-				auto src_x = x - p.x;
-				if ((src_x >= 0) & (src_x < (int)logical_screen_width)){
-					auto &tile = this->window_tilemap.tiles[src_x / tile_size + y_prime];
-					auto tile_no = tile.tile_no;
-					tile_no = tile_mapping[tile_no];
-					auto tile_offset_x = src_x % tile_size;
-					auto tile_offset_y = wy_prime % tile_size;
-					color_index = this->tile_data[tile_no].data[tile_offset_x + tile_offset_y * tile_size];
-					palette = &tile.palette;
-					if (!*palette)
-						palette = &this->bg_palette;
-				}
-			}
 
-			if (this->enable_bg & !palette){
-				auto p = bg_offset + Point{ x, y };
-				p.x = euclidean_modulo(p.x, Tilemap::w * tile_size);
-				p.y = euclidean_modulo(p.y, Tilemap::h * tile_size);
-				auto &tile = this->bg_tilemap.tiles[p.x / tile_size + p.y / tile_size * Tilemap::w];
-				auto tile_no = tile.tile_no;
-				tile_no = tile_mapping[tile_no];
-				int tile_offset_x = p.x % tile_size;
-				int tile_offset_y = p.y % tile_size;
-				if (tile.flipped_x)
-					tile_offset_x = (tile_size - 1) - tile_offset_x;
-				if (tile.flipped_y)
-					tile_offset_y = (tile_size - 1) - tile_offset_y;
-				color_index = this->tile_data[tile_no].data[tile_offset_x + tile_offset_y * tile_size];
-				palette = &tile.palette;
-				if (!*palette)
-					palette = &this->bg_palette;
-			}
+		//The window, when visible, covers the line from window_x to the right
+		//edge of the screen. The background only shows to the left of it.
+		int window_x = logical_screen_width;
+		if (window_enabled){
+			window_x = std::min(euclidean_modulo(window_offset.x, Tilemap::w * tile_size), (int)logical_screen_width);
+			this->render_tilemap_span(row + window_x, logical_screen_width - window_x, this->window_tilemap, 0, wy_prime, false);
 		}
+
+		if (this->enable_bg)
+			this->render_tilemap_span(row, window_x, this->bg_tilemap, bg_offset.x, bg_offset.y + y, true);
+		else
+			std::fill(row, row + window_x, empty);
+	}
+}
+
+//Renders length points of a single line of a tilemap, starting from pixel
+//(src_x, src_y) of the tilemap and wrapping around its edges. Each tile is
+//resolved only once for all the points it covers. The flip flags of the tiles
+//are ignored unless use_flips is set, since the window has never drawn them.
+void Renderer::render_tilemap_span(RenderPoint *dst, int length, const Tilemap &tilemap, int src_x, int src_y, bool use_flips){
+	const int w = Tilemap::w * tile_size;
+	src_x = euclidean_modulo(src_x, w);
+	src_y = euclidean_modulo(src_y, Tilemap::h * tile_size);
+	auto tiles = tilemap.tiles + src_y / tile_size * Tilemap::w;
+	int tile_offset_y = src_y % tile_size;
+
+	while (length > 0){
+		auto &tile = tiles[src_x / tile_size];
+		int tile_offset_x = src_x % tile_size;
+		int span = std::min(tile_size - tile_offset_x, length);
+		auto &tile_data = use_flips ? this->get_tile_data(tile) : this->tile_data[tile_mapping[tile.tile_no] * tile_flip_variants];
+		auto data = tile_data.data + tile_offset_y * tile_size + tile_offset_x;
+		auto &palette = !tile.palette ? this->bg_palette : tile.palette;
+		const RenderPoint points[] = {
+			make_render_point(palette, 0),
+			make_render_point(palette, 1),
+			make_render_point(palette, 2),
+			make_render_point(palette, 3),
+		};
+
+		for (int i = 0; i < span; i++)
+			dst[i] = points[data[i]];
+
+		dst += span;
+		length -= span;
+		src_x = (src_x + span) % w;
 	}
 }
 
-void Renderer::render_sprites(){
+void Renderer::prepare_sprites(){
 	if (!this->enable_sprites)
 		return;
+	this->sprites.sort_order();
+	this->build_line_sprites();
+}
 
-	this->sprite_list.clear();
-	for (auto &kv : this->sprites){
-		auto sprite = kv.second;
-		auto x0 = sprite->get_x();
-		auto y0 = sprite->get_y();
-		auto x1 = x0 + sprite->get_w();
-		auto y1 = y0 + sprite->get_h();
-		if (!sprite->get_visible() | (y0 >= logical_screen_height) | (x0 >= logical_screen_width) | (y1 <= 0) | (x1 <= 0))
-			continue;
-		this->sprite_list.push_back(sprite);
-	}
-		
-	std::sort(this->sprite_list.begin(), this->sprite_list.end(), sort_sprites);
+void Renderer::render_sprites(int y0, int y1){
+	if (!this->enable_sprites)
+		return;
 
 	const Palette *sprite_palettes[] = {
 		nullptr,
@@ -172,62 +210,233 @@ void Renderer::render_sprites(){
 		&this->sprite1_palette,
 	};
 
-	for (auto sprite : this->sprite_list)
-		this->render_sprite(*sprite, sprite_palettes);
+	for (int y = y0; y < y1; y++){
+		if (!this->dirty_lines[y])
+			continue;
+		auto begin = this->line_sprite_offsets[y];
+		auto end = this->line_sprite_offsets[y + 1];
+		for (auto i = begin; i < end; i++)
+			this->render_sprite_line(this->line_sprites[i], y, sprite_palettes);
+	}
 }
 
-void Renderer::render_sprite(Sprite &sprite, const Palette **sprite_palettes){
-	auto spry = sprite.get_y();
-	auto sprx = sprite.get_x();
-	auto w = sprite.get_w() * tile_size;
-	auto h = sprite.get_h() * tile_size;
-	auto x0 = std::max(sprx, 0);
-	auto y0 = std::max(spry, 0);
-	auto x1 = std::min(sprx + w, (int)logical_screen_width);
-	auto y1 = std::min(spry + h, (int)logical_screen_height);
+//Builds, for each line, the list of the sprites that intersect it, in drawing
+//order. The lists are stored back to back in line_sprites, so building them
+//takes two passes: one to count the sprites in each line and one to fill them.
+void Renderer::build_line_sprites(){
+	auto &sprites = this->sprites;
+	auto &offsets = this->line_sprite_offsets;
+	fill(offsets, 0);
+	for (auto slot : sprites.order){
+		if (!sprite_is_on_screen(sprites, slot))
+			continue;
+		auto y0 = std::max(sprites.ys[slot], 0);
+		auto y1 = std::min(sprites.ys[slot] + sprites.hs[slot] * tile_size, (int)logical_screen_height);
+		for (int y = y0; y < y1; y++)
+			offsets[y + 1]++;
+	}
+	for (int y = 0; y < logical_screen_height; y++)
+		offsets[y + 1] += offsets[y];
+
+	this->line_sprites.resize(offsets[logical_screen_height]);
+	int next[logical_screen_height];
+	std::copy(offsets, offsets + logical_screen_height, next);
+	for (auto slot : sprites.order){
+		if (!sprite_is_on_screen(sprites, slot))
+			continue;
+		auto y0 = std::max(sprites.ys[slot], 0);
+		auto y1 = std::min(sprites.ys[slot] + sprites.hs[slot] * tile_size, (int)logical_screen_height);
+		for (int y = y0; y < y1; y++)
+			this->line_sprites[next[y]++] = slot;
+	}
+}
 
-	for (int y = y0, sprite_offset_y = 0; y < y1; y++, sprite_offset_y++){
-		for (int x = x0, sprite_offset_x = 0; x < x1; x++, sprite_offset_x++){
-			auto &point = this->intermediate_render_surface[x + y * logical_screen_width];
-			auto &color_index = point.value;
-			auto &palette = point.palette;
+//Draws a single line of a sprite. Each tile row is resolved only once for all
+//the points it covers.
+void Renderer::render_sprite_line(int slot, int y, const Palette **sprite_palettes){
+	auto &sprites = this->sprites;
+	auto tiles_w = sprites.ws[slot];
+	auto x0 = std::max(sprites.xs[slot], 0);
+	auto x1 = std::min(sprites.xs[slot] + tiles_w * tile_size, (int)logical_screen_width);
+	//Note: the sprite is drawn from its top left corner even if the sprite is
+	//partially off the top or left edges of the screen.
+	auto sprite_offset_y = y - std::max(sprites.ys[slot], 0);
+	auto tiles = sprites.get_tiles(slot) + sprite_offset_y / tile_size * tiles_w;
+	int tile_offset_y = sprite_offset_y % tile_size;
+	auto row = this->intermediate_render_surface + y * logical_screen_width;
+
+	for (int x = x0; x < x1; x += tile_size, tiles++){
+		auto &tile = *tiles;
+		int span = std::min((int)tile_size, x1 - x);
+		auto data = this->get_tile_data(tile).data + tile_offset_y * tile_size;
+		const Palette *palette = &tile.palette;
+		if (!*palette){
+			palette = &sprites.palettes[slot];
+			if (!*palette)
+				palette = sprite_palettes[(int)sprites.palette_regions[slot]];
+		}
+		const RenderPoint points[] = {
+			0,
+			make_render_point(*palette, 1),
+			make_render_point(*palette, 2),
+			make_render_point(*palette, 3),
+		};
+		//Without priority, the sprite is hidden behind opaque points.
+		const RenderPoint hidden_mask = tile.has_priority ? 0 : render_point_opaque;
+
+		auto dst = row + x;
+		for (int i = 0; i < span; i++){
+			auto index = data[i];
+			if (index && !(dst[i] & hidden_mask))
+				dst[i] = points[index];
+		}
+	}
+}
 
-			auto sprite_tile_x = sprite_offset_x / tile_size;
-			auto sprite_tile_y = sprite_offset_y / tile_size;
+Renderer::RenderPoint Renderer::make_render_point(const Palette &palette, int color_index){
+	return (palette.data[color_index] & render_point_shade_mask) | (color_index ? render_point_opaque : 0);
+}
 
-			auto &tile = sprite.get_tile(sprite_tile_x, sprite_tile_y);
-			auto sprite_is_not_covered_here = tile.has_priority | !color_index;
-			if (!sprite_is_not_covered_here)
-				continue;
+#if defined __AVX2__
+//Resolves 32 points per iteration by using the points directly as indices into
+//an 8-entry table (the final palette, repeated once to ignore the opaque bit).
+static size_t final_render_simd(std::uint32_t *dst, const byte_t *src, size_t n, const RGB (&final_palette)[4]){
+	std::uint32_t table[8];
+	memcpy(table, final_palette, sizeof(final_palette));
+	memcpy(table + 4, final_palette, sizeof(final_palette));
+	auto lut = _mm256_loadu_si256((const __m256i *)table);
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32){
+		for (int j = 0; j < 4; j++){
+			auto indices = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i + j * 8)));
+			_mm256_storeu_si256((__m256i *)(dst + i + j * 8), _mm256_permutevar8x32_epi32(lut, indices));
+		}
+	}
+	return i;
+}
+#elif defined USE_SSE2_FINAL_RENDER
+//Resolves 16 points per iteration by comparing each against the four possible
+//shades and selecting the matching color.
+static size_t final_render_simd(std::uint32_t *dst, const byte_t *src, size_t n, const RGB (&final_palette)[4]){
+	__m128i colors[4];
+	__m128i shades[4];
+	for (int i = 0; i < 4; i++){
+		std::uint32_t color;
+		memcpy(&color, final_palette + i, sizeof(color));
+		colors[i] = _mm_set1_epi32((int)color);
+		shades[i] = _mm_set1_epi32(i);
+	}
+	const auto zero = _mm_setzero_si128();
+	const auto mask = _mm_set1_epi8(Renderer::render_point_shade_mask);
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16){
+		auto bytes = _mm_and_si128(_mm_loadu_si128((const __m128i *)(src + i)), mask);
+		auto lo = _mm_unpacklo_epi8(bytes, zero);
+		auto hi = _mm_unpackhi_epi8(bytes, zero);
+		const __m128i indices[] = {
+			_mm_unpacklo_epi16(lo, zero),
+			_mm_unpackhi_epi16(lo, zero),
+			_mm_unpacklo_epi16(hi, zero),
+			_mm_unpackhi_epi16(hi, zero),
+		};
+		for (int j = 0; j < 4; j++){
+			auto result = _mm_and_si128(_mm_cmpeq_epi32(indices[j], shades[0]), colors[0]);
+			for (int k = 1; k < 4; k++)
+				result = _mm_or_si128(result, _mm_and_si128(_mm_cmpeq_epi32(indices[j], shades[k]), colors[k]));
+			_mm_storeu_si128((__m128i *)(dst + i + j * 4), result);
+		}
+	}
+	return i;
+}
+#else
+static size_t final_render_simd(std::uint32_t *, const byte_t *, size_t, const RGB (&)[4]){
+	return 0;
+}
+#endif
 
-			auto tile_no = tile.tile_no;
-			tile_no = tile_mapping[tile_no];
-			int tile_offset_x = sprite_offset_x % tile_size;
-			int tile_offset_y = sprite_offset_y % tile_size;
-			if (tile.flipped_x)
-				tile_offset_x = (tile_size - 1) - tile_offset_x;
-			if (tile.flipped_y)
-				tile_offset_y = (tile_size - 1) - tile_offset_y;
-			auto index = this->tile_data[tile_no].data[tile_offset_x + tile_offset_y * tile_size];
-			if (!index)
-				continue;
-			color_index = index;
-			palette = &tile.palette;
-			if (!*palette){
-				palette = &sprite.get_palette();
-				if (!*palette)
-					palette = sprite_palettes[(int)sprite.get_palette_region()];
-			}
+//Scales lines [y0, y1) of src, which is w points wide, by an integer factor.
+static void scale_nearest(Renderer::RenderPoint *dst, const Renderer::RenderPoint *src, int w, int scale, int y0, int y1){
+	auto dst_w = w * scale;
+	for (int y = y0; y < y1; y++){
+		auto row = dst + y * scale * dst_w;
+		auto src_row = src + y * w;
+		for (int x = 0; x < w; x++)
+			memset(row + x * scale, src_row[x], scale);
+		for (int i = 1; i < scale; i++)
+			memcpy(row + i * dst_w, row, dst_w);
+	}
+}
+
+//Scales lines [y0, y1) of src, which is w by h points, by two with Scale2x.
+//Only the shades of the points are compared and copied.
+static void scale2x_lines(Renderer::RenderPoint *dst, const Renderer::RenderPoint *src, int w, int h, int y0, int y1){
+	const auto mask = Renderer::render_point_shade_mask;
+	auto dst_w = w * 2;
+	for (int y = y0; y < y1; y++){
+		auto above = src + std::max(y - 1, 0) * w;
+		auto row = src + y * w;
+		auto below = src + std::min(y + 1, h - 1) * w;
+		auto dst0 = dst + y * 2 * dst_w;
+		auto dst1 = dst0 + dst_w;
+		for (int x = 0; x < w; x++){
+			Renderer::RenderPoint b = above[x] & mask;
+			Renderer::RenderPoint d = row[std::max(x - 1, 0)] & mask;
+			Renderer::RenderPoint e = row[x] & mask;
+			Renderer::RenderPoint f = row[std::min(x + 1, w - 1)] & mask;
+			Renderer::RenderPoint h2 = below[x] & mask;
+			if (b != h2 && d != f){
+				dst0[x * 2] = d == b ? d : e;
+				dst0[x * 2 + 1] = b == f ? f : e;
+				dst1[x * 2] = d == h2 ? d : e;
+				dst1[x * 2 + 1] = h2 == f ? f : e;
+			}else
+				dst0[x * 2] = dst0[x * 2 + 1] = dst1[x * 2] = dst1[x * 2 + 1] = e;
 		}
 	}
 }
 
-void Renderer::final_render(TextureSurface &surf){
-	auto pixels = surf.get_row(0);
-	for (auto &point : this->intermediate_render_surface){
-		auto color_index = point.value;
-		auto palette = point.palette;
-		*(pixels++) = this->final_palette[!palette ? 0 : palette->data[color_index]];
+//Resolves lines [y0, y1) of the intermediate surface to pixels, scaling them
+//up first if needed. Not used by Scale2x.
+void Renderer::final_render(RGB *pixels, int y0, int y1){
+	if (this->upscaler == Upscaler::None){
+		this->resolve(pixels, this->intermediate_render_surface, logical_screen_width, y0, y1);
+		return;
+	}
+	auto dst = &this->upscaled_surfaces[0][0];
+	scale_nearest(dst, this->intermediate_render_surface, logical_screen_width, this->scale, y0, y1);
+	this->resolve(pixels, dst, logical_screen_width * this->scale, y0 * this->scale, y1 * this->scale);
+}
+
+//Resolves lines [y0, y1) of src, which is w points wide, to pixels.
+void Renderer::resolve(RGB *pixels, const RenderPoint *src, int w, int y0, int y1){
+	static_assert(sizeof(RGB) == sizeof(std::uint32_t), "RGB struct has been padded too far!");
+	pixels += y0 * w;
+	src += y0 * w;
+	const size_t n = (y1 - y0) * w;
+	auto i = final_render_simd((std::uint32_t *)pixels, src, n, this->final_palette);
+	for (; i < n; i++)
+		pixels[i] = this->final_palette[src[i] & render_point_shade_mask];
+}
+
+//Upscales the whole intermediate surface with one Scale2x pass per doubling,
+//then resolves it to pixels. Each pass reads lines from other bands, so each
+//needs to wait for the previous one to finish.
+void Renderer::scale2x(RGB *pixels){
+	const RenderPoint *src = this->intermediate_render_surface;
+	int w = logical_screen_width;
+	int h = logical_screen_height;
+	for (int i = 0; w < logical_screen_width * this->scale; i++){
+		auto dst = &this->upscaled_surfaces[i % 2][0];
+		bool last = w * 2 == logical_screen_width * this->scale;
+		this->workers.run([=](int band){
+			auto range = this->workers.get_band(band, h);
+			scale2x_lines(dst, src, w, h, range.first, range.second);
+			if (last)
+				this->resolve(pixels, dst, w * 2, range.first * 2, range.second * 2);
+		});
+		src = dst;
+		w *= 2;
+		h *= 2;
 	}
 }
 
@@ -296,8 +505,121 @@ Tilemap &Renderer::get_tilemap(TileRegion region){
 	return this->bg_tilemap;
 }
 
+bool Renderer::find_dirty_lines(){
+	const Palette palettes[] = { this->bg_palette, this->sprite0_palette, this->sprite1_palette };
+	const bool enables[] = { this->enable_bg, this->enable_window, this->enable_sprites };
+#ifdef ALWAYS_RENDER
+	bool full_redraw = true;
+#else
+	bool full_redraw = this->force_full_redraw;
+#endif
+	this->force_full_redraw = false;
+	for (int i = 0; i < 3; i++){
+		full_redraw |= palettes[i] != this->last_palettes[i] || enables[i] != this->last_enables[i];
+		this->last_palettes[i] = palettes[i];
+		this->last_enables[i] = enables[i];
+	}
+	fill(this->dirty_lines, full_redraw);
+
+	bool bg_rows[Tilemap::h];
+	bool window_rows[Tilemap::h];
+	update_tilemap_state(bg_rows, this->last_bg_tilemap, this->bg_tilemap);
+	update_tilemap_state(window_rows, this->last_window_tilemap, this->window_tilemap);
+
+	//A line is dirty if its offsets changed or if the tilemap row it shows
+	//changed.
+	for (int y = 0; y < logical_screen_height; y++){
+		auto bg_offset = this->bg_global_offset + this->bg_offsets[y];
+		auto window_offset = this->window_global_offset + this->window_offsets[y];
+		auto wy_prime = y - window_offset.y;
+		auto &dirty = this->dirty_lines[y];
+		dirty |= bg_offset != this->last_bg_offsets[y] || window_offset != this->last_window_offsets[y];
+		dirty |= this->enable_bg && bg_rows[euclidean_modulo(bg_offset.y + y, Tilemap::h * tile_size) / tile_size];
+		dirty |= this->enable_window && wy_prime >= 0 && wy_prime < logical_screen_height && window_rows[wy_prime / tile_size];
+		this->last_bg_offsets[y] = bg_offset;
+		this->last_window_offsets[y] = window_offset;
+	}
+
+	this->find_dirty_sprite_lines();
+
+	return std::find(this->dirty_lines, this->dirty_lines + logical_screen_height, true) != this->dirty_lines + logical_screen_height;
+}
+
+void Renderer::update_tilemap_state(bool (&dirty_rows)[Tilemap::h], Tilemap &last, const Tilemap &current){
+	for (int y = 0; y < Tilemap::h; y++){
+		auto row = current.tiles + y * Tilemap::w;
+		auto last_row = last.tiles + y * Tilemap::w;
+		dirty_rows[y] = !std::equal(row, row + Tilemap::w, last_row);
+		if (dirty_rows[y])
+			std::copy(row, row + Tilemap::w, last_row);
+	}
+}
+
+//Marks the lines covered by every sprite that appeared, disappeared or changed
+//since the last frame, both where it was and where it is now.
+void Renderer::find_dirty_sprite_lines(){
+	auto &old_sprites = this->last_sprites;
+	auto &new_sprites = this->sprites;
+	//Enabling or disabling sprites redraws the whole frame.
+	if (this->enable_sprites){
+		//Both pools are sorted by ID.
+		size_t i = 0, j = 0;
+		while (i < old_sprites.size() || j < new_sprites.size()){
+			if (j == new_sprites.size() || (i < old_sprites.size() && old_sprites.ids[i] < new_sprites.ids[j])){
+				this->set_dirty_sprite_lines(old_sprites, (int)i++);
+				continue;
+			}
+			if (i == old_sprites.size() || new_sprites.ids[j] < old_sprites.ids[i]){
+				this->set_dirty_sprite_lines(new_sprites, (int)j++);
+				continue;
+			}
+			if (!sprites_are_equal(old_sprites, (int)i, new_sprites, (int)j)){
+				this->set_dirty_sprite_lines(old_sprites, (int)i);
+				this->set_dirty_sprite_lines(new_sprites, (int)j);
+			}
+			i++;
+			j++;
+		}
+	}
+	old_sprites = new_sprites;
+}
+
+bool Renderer::sprite_is_on_screen(const SpritePool &sprites, int slot){
+	auto x0 = sprites.xs[slot];
+	auto y0 = sprites.ys[slot];
+	auto x1 = x0 + sprites.ws[slot];
+	auto y1 = y0 + sprites.hs[slot];
+	return sprites.registered[slot] & sprites.visible[slot] & (y0 < logical_screen_height) & (x0 < logical_screen_width) & (y1 > 0) & (x1 > 0);
+}
+
+bool Renderer::sprites_are_equal(const SpritePool &a, int i, const SpritePool &b, int j){
+	bool on_screen = sprite_is_on_screen(a, i);
+	if (on_screen != sprite_is_on_screen(b, j))
+		return false;
+	if (!on_screen)
+		return true;
+	if (a.xs[i] != b.xs[j] || a.ys[i] != b.ys[j] || a.ws[i] != b.ws[j] || a.hs[i] != b.hs[j] || a.palettes[i] != b.palettes[j] || a.palette_regions[i] != b.palette_regions[j])
+		return false;
+	auto tiles = a.get_tiles(i);
+	return std::equal(tiles, tiles + a.ws[i] * a.hs[i], b.get_tiles(j));
+}
+
+void Renderer::set_dirty_sprite_lines(const SpritePool &sprites, int slot){
+	if (sprite_is_on_screen(sprites, slot))
+		this->set_dirty_lines(sprites.ys[slot], sprites.ys[slot] + sprites.hs[slot] * tile_size);
+}
+
+void Renderer::set_dirty_lines(int y0, int y1){
+	y0 = std::max(y0, 0);
+	y1 = std::min(y1, (int)logical_screen_height);
+	for (int y = y0; y < y1; y++)
+		this->dirty_lines[y] = true;
+}
+
 void Renderer::render(){
-	this->do_software_rendering();
+	//Unchanged frames leave the texture as it was.
+	if (this->find_dirty_lines())
+		this->do_software_rendering();
 	this->device->render_copy(this->main_texture);
 }
 
@@ -333,12 +655,9 @@ void Renderer::clear_subpalettes(SubPaletteRegion region){
 			if (region != SubPaletteRegion::All)
 				break;
 		case SubPaletteRegion::Sprites:
-			for (auto &sprite : this->sprites){
-				sprite.second->set_palette(null_palette);
-				auto its = sprite.second->iterate_tiles();
-				for (auto it = its.first; it != its.second; ++it)
-					it->palette = null_palette;
-			}
+			fill(this->sprites.palettes, null_palette);
+			for (auto &tile : this->sprites.tiles)
+				tile.palette = null_palette;
 			if (region != SubPaletteRegion::All)
 				break;
 	}
@@ -386,9 +705,6 @@ void Renderer::fill_rectangle(TileRegion region, const Point &corner, const Poin
 
 std::shared_ptr<Sprite> Renderer::create_sprite(int tiles_w, int tiles_h){
 	auto ret = std::make_shared<Sprite>(*this, tiles_w, tiles_h);
-	this->sprites[ret->get_id()] = ret.get();
-	if (this->sprite_list.capacity() < this->sprites.size())
-		this->sprite_list.reserve(this->sprites.size());
 	return ret;
 }
 
@@ -401,15 +717,9 @@ std::shared_ptr<Sprite> Renderer::create_sprite(const GraphicsAsset &asset){
 	return ret;
 }
 
+//Stops drawing all existing sprites. Their handles remain valid.
 void Renderer::clear_sprites(){
-	this->sprites.clear();
-}
-
-void Renderer::release_sprite(std::uint64_t id){
-	auto it = this->sprites.find(id);
-	if (it == this->sprites.end())
-		return;
-	this->sprites.erase(it);
+	fill(this->sprites.registered, false);
 }
 
 std::uint64_t Renderer::get_id(){
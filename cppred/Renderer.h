@@ -4,9 +4,9 @@
 #include "RendererStructs.h"
 #include "Sprite.h"
 #include "VideoDevice.h"
+#include "WorkerPool.h"
 #include <SDL.h>
 #include <vector>
-#include <map>
 #include <memory>
 
 class Engine;
@@ -23,11 +23,22 @@ public:
 	static const int tilemap_height = Tilemap::h;
 	//Types:
 	typedef BasicTileData<tile_size> TileData;
-	typedef std::map<std::uint64_t, Sprite *> sprite_map_t;
-	typedef typename sprite_map_t::iterator sprite_iterator;
+	//Every tile is stored once per combination of flips: unflipped, flipped in
+	//x, flipped in y, and flipped in both.
+	static const int tile_flip_variants = 4;
+	//Each point of the intermediate surface holds the final shade (bits 0-1),
+	//already resolved through the point's palette, and whether the point is
+	//opaque (bit 2), which sprites without priority need to know. Points not
+	//covered by the background nor by the window are opaque and have shade 0.
+	typedef byte_t RenderPoint;
+	static const RenderPoint render_point_shade_mask = 3;
+	static const RenderPoint render_point_opaque = 4;
 
 private:
+
 	VideoDevice *device;
+	Upscaler upscaler;
+	int scale;
 	Texture main_texture;
 	std::vector<TileData> tile_data;
 	Tilemap bg_tilemap;
@@ -40,30 +51,65 @@ private:
 	Point window_offsets[logical_screen_height];
 	Point bg_global_offset = { 0, 0 };
 	Point window_global_offset = { 0, 0 };
-	sprite_map_t sprites;
-	std::vector<Sprite *> sprite_list;
+	SpritePool sprites;
 	std::uint64_t next_sprite_id = 0;
 	bool enable_bg = false;
 	bool enable_window = false;
 	bool enable_sprites = true;
-	struct RenderPoint{
-		int value;
-		const Palette *palette;
-	};
 	RenderPoint intermediate_render_surface[logical_screen_width * logical_screen_height];
+	//Intermediate surface scaled up by the CPU upscaler. Scale2x alternates
+	//between both buffers, one pass per doubling.
+	std::vector<RenderPoint> upscaled_surfaces[2];
+	WorkerPool workers;
+	//Copy of the state that was used to render the last frame. Tiles are
+	//usually modified directly through references, so changes are detected by
+	//comparison rather than by the setters.
+	Tilemap last_bg_tilemap;
+	Tilemap last_window_tilemap;
+	Palette last_palettes[3];
+	bool last_enables[3];
+	Point last_bg_offsets[logical_screen_height];
+	Point last_window_offsets[logical_screen_height];
+	SpritePool last_sprites;
+	//Sprites that intersect each line, in drawing order. The sprites of line y
+	//are line_sprites[line_sprite_offsets[y]] up to
+	//line_sprites[line_sprite_offsets[y + 1]].
+	std::vector<int> line_sprites;
+	int line_sprite_offsets[logical_screen_height + 1];
+	bool force_full_redraw = true;
+	bool compute_frame_hash = false;
+	std::uint64_t frame_hash = 0;
+	bool dirty_lines[logical_screen_height];
 
 	void initialize_assets();
+	const TileData &get_tile_data(const Tile &) const;
 	void initialize_data();
+	bool find_dirty_lines();
+	static void update_tilemap_state(bool (&dirty_rows)[Tilemap::h], Tilemap &last, const Tilemap &current);
+	void find_dirty_sprite_lines();
+	static bool sprite_is_on_screen(const SpritePool &, int slot);
+	static bool sprites_are_equal(const SpritePool &, int, const SpritePool &, int);
+	void set_dirty_sprite_lines(const SpritePool &, int slot);
+	void set_dirty_lines(int y0, int y1);
 	void do_software_rendering();
-	void render_non_sprites();
-	void render_sprites();
-	void render_sprite(Sprite &, const Palette **);
-	void final_render(TextureSurface &);
+	void prepare_sprites();
+	void render_non_sprites(int y0, int y1);
+	void render_tilemap_span(RenderPoint *dst, int length, const Tilemap &, int src_x, int src_y, bool use_flips);
+	void render_sprites(int y0, int y1);
+	void build_line_sprites();
+	void render_sprite_line(int slot, int y, const Palette **);
+	void final_render(RGB *pixels, int y0, int y1);
+	void resolve(RGB *pixels, const RenderPoint *src, int w, int y0, int y1);
+	void scale2x(RGB *pixels);
+	static RenderPoint make_render_point(const Palette &, int color_index);
 	void set_y_offset(Point (&)[logical_screen_height], int y0, int y1, const Point &);
 	std::vector<Point> draw_image_to_tilemap_internal(const Point &corner, const GraphicsAsset &, TileRegion, Palette, bool);
 public:
-	Renderer(VideoDevice &);
-	static std::unique_ptr<VideoDevice> initialize_device(int scale);
+	//The scale of the CPU upscaler is the size of the device over the size of
+	//the logical screen. render_threads counts the calling thread; 0 means one
+	//thread per core.
+	Renderer(VideoDevice &, Upscaler = Upscaler::None, unsigned render_threads = 1);
+	static std::unique_ptr<VideoDevice> initialize_device(int scale, bool headless = false);
 	Renderer(const Renderer &) = delete;
 	Renderer(Renderer &&) = delete;
 	void operator=(const Renderer &) = delete;
@@ -92,9 +138,14 @@ public:
 	void clear_sprites();
 	std::shared_ptr<Sprite> create_sprite(int tiles_w, int tiles_h);
 	std::shared_ptr<Sprite> create_sprite(const GraphicsAsset &);
-	//std::pair<sprite_iterator, sprite_iterator> iterate_sprites();
-	void release_sprite(std::uint64_t);
+	SpritePool &get_sprite_pool(){
+		return this->sprites;
+	}
 	std::uint64_t get_id();
+	//When enabled, every rendered frame is hashed with hash_frame().
+	DEFINE_GETTER_SETTER(compute_frame_hash)
+	//Hash of the current contents of the main texture.
+	DEFINE_GETTER(frame_hash)
 	DEFINE_GETTER_SETTER(bg_global_offset)
 	DEFINE_GETTER_SETTER(window_global_offset)
 	void set_y_bg_offset(int y0, int y1, const Point &);
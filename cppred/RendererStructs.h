@@ -1,6 +1,7 @@
 #pragma once
 
 #include "utility.h"
+#include <cstring>
 
 enum class PaletteRegion{
 	Background = 0,
@@ -20,6 +21,15 @@ enum class TileRegion{
 	Window,
 };
 
+enum class Upscaler{
+	//The frame is scaled by the video device.
+	None,
+	Nearest,
+	//Scale2x (AdvMAME2x), applied once per doubling. Requires a power of two
+	//scale.
+	Scale2x,
+};
+
 struct RGB{
 	byte_t r, g, b, a;
 };
@@ -49,6 +59,12 @@ public:
 	bool operator!() const{
 		return this->data[0] == -1;
 	}
+	bool operator==(const Palette &other) const{
+		return !memcmp(this->data, other.data, sizeof(this->data));
+	}
+	bool operator!=(const Palette &other) const{
+		return !(*this == other);
+	}
 };
 
 static const Palette zero_palette = { 0, 0, 0, 0 };
@@ -74,6 +90,12 @@ public:
 		flipped_x(flipped_x),
 		flipped_y(flipped_y),
 		palette(palette){}
+	bool operator==(const Tile &other) const{
+		return this->tile_no == other.tile_no && this->flipped_x == other.flipped_x && this->flipped_y == other.flipped_y && this->palette == other.palette;
+	}
+	bool operator!=(const Tile &other) const{
+		return !(*this == other);
+	}
 };
 
 class SpriteTile : public Tile{
@@ -83,6 +105,12 @@ public:
 	SpriteTile(std::uint16_t tile_no = 0, bool flipped_x = false, bool flipped_y = false, bool has_priority = false, Palette palette = null_palette):
 		Tile(tile_no, flipped_x, flipped_y, palette),
 		has_priority(has_priority){}
+	bool operator==(const SpriteTile &other) const{
+		return Tile::operator==(other) && this->has_priority == other.has_priority;
+	}
+	bool operator!=(const SpriteTile &other) const{
+		return !(*this == other);
+	}
 };
 
 struct Tilemap{
@@ -122,6 +150,12 @@ struct Point{
 		this->y = cast_round(this->y * x);
 		return *this;
 	}
+	bool operator==(const Point &other) const{
+		return this->x == other.x && this->y == other.y;
+	}
+	bool operator!=(const Point &other) const{
+		return !(*this == other);
+	}
 	int multiply_components() const{
 		return this->x * this->y;
 	}
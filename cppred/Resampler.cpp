@@ -0,0 +1,101 @@
+#include "Resampler.h"
+#include <algorithm>
+#include <cmath>
+
+static const double pi = 3.1415926535897932384626433832795;
+//Filter width when upsampling. It grows in proportion when downsampling.
+static const unsigned base_taps = 16;
+//Cutoff, relative to the lower of the two Nyquist frequencies.
+static const double relative_cutoff = 0.9;
+
+static unsigned gcd(unsigned a, unsigned b){
+	while (b){
+		auto t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static double sinc(double x){
+	if (!x)
+		return 1;
+	return sin(pi * x) / (pi * x);
+}
+
+static double blackman(double x, double width){
+	//x in [-width / 2, width / 2]
+	auto t = 2 * pi * x / width;
+	return 0.42 + 0.5 * cos(t) + 0.08 * cos(2 * t);
+}
+
+Resampler::Resampler(unsigned src_frequency, unsigned dst_frequency): src_frequency(src_frequency), dst_frequency(dst_frequency){
+	if (this->is_passthrough())
+		return;
+	auto d = gcd(src_frequency, dst_frequency);
+	this->L = dst_frequency / d;
+	this->M = src_frequency / d;
+	auto ratio = std::min(1.0, (double)dst_frequency / src_frequency);
+	this->taps = (unsigned)ceil(base_taps / ratio);
+	this->taps += this->taps % 2;
+	this->phases = std::min(this->L, max_phases);
+	auto cutoff = relative_cutoff * ratio;
+
+	this->coefficients.resize((size_t)this->phases * this->taps);
+	std::vector<double> filter(this->taps);
+	const auto one = 1 << coefficient_bits;
+	for (unsigned p = 0; p < this->phases; p++){
+		auto fraction = (double)p / this->phases;
+		double sum = 0;
+		for (unsigned k = 0; k < this->taps; k++){
+			auto x = (double)k - (this->taps / 2 - 1) - fraction;
+			filter[k] = sinc(cutoff * x) * blackman(x, this->taps);
+			sum += filter[k];
+		}
+		auto dst = &this->coefficients[(size_t)p * this->taps];
+		int total = 0;
+		unsigned largest = 0;
+		for (unsigned k = 0; k < this->taps; k++){
+			dst[k] = (std::int32_t)floor(filter[k] * one / sum + 0.5);
+			total += dst[k];
+			if (dst[k] > dst[largest])
+				largest = k;
+		}
+		//Absorb the rounding error, so that a constant input gives exactly the
+		//same constant output.
+		dst[largest] += one - total;
+	}
+	this->input.reserve(AudioFrame::max_length + this->taps);
+}
+
+static std::int16_t clamp_sample(std::int64_t x){
+	const std::int64_t max = (1 << 15) - 1;
+	return (std::int16_t)std::max(std::min(x, max), -max - 1);
+}
+
+void Resampler::process(const StereoSampleFinal *src, size_t count, std::vector<StereoSampleFinal> &dst){
+	if (this->is_passthrough()){
+		dst.insert(dst.end(), src, src + count);
+		return;
+	}
+	this->input.insert(this->input.end(), src, src + count);
+	while (this->position + this->taps <= this->input.size()){
+		auto filter = &this->coefficients[(std::uint64_t)this->phase * this->phases / this->L * this->taps];
+		auto in = &this->input[this->position];
+		std::int64_t left = 0,
+			right = 0;
+		for (unsigned k = 0; k < this->taps; k++){
+			left += in[k].left * filter[k];
+			right += in[k].right * filter[k];
+		}
+		StereoSampleFinal sample;
+		sample.left = clamp_sample(left >> coefficient_bits);
+		sample.right = clamp_sample(right >> coefficient_bits);
+		dst.push_back(sample);
+		this->phase += this->M;
+		this->position += this->phase / this->L;
+		this->phase %= this->L;
+	}
+	this->input.erase(this->input.begin(), this->input.begin() + this->position);
+	this->position = 0;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "AudioData.h"
+#include <cstddef>
+#include <vector>
+
+//Polyphase windowed-sinc sample rate converter. The ratio between the rates is
+//reduced to L/M, and each output sample is computed from a fixed number of
+//input samples with one of L precomputed filters. If L is too large, the
+//filter is chosen from a smaller set of phases, which slightly quantizes the
+//output times. The output lags the input by half the filter width.
+class Resampler{
+	unsigned src_frequency;
+	unsigned dst_frequency;
+	unsigned L = 1, M = 1;
+	unsigned taps = 0;
+	unsigned phases = 0;
+	//phases filters of taps coefficients each. The coefficients of every
+	//filter add up to exactly 1 << coefficient_bits.
+	std::vector<std::int32_t> coefficients;
+	//Input not yet fully consumed.
+	std::vector<StereoSampleFinal> input;
+	//Position of the next output sample: input[position] plus phase / L.
+	size_t position = 0;
+	unsigned phase = 0;
+public:
+	static const unsigned coefficient_bits = 14;
+	static const unsigned max_phases = 512;
+
+	Resampler(unsigned src_frequency, unsigned dst_frequency);
+	bool is_passthrough() const{
+		return this->src_frequency == this->dst_frequency;
+	}
+	unsigned get_src_frequency() const{
+		return this->src_frequency;
+	}
+	unsigned get_dst_frequency() const{
+		return this->dst_frequency;
+	}
+	//Consumes count input samples and appends every output sample that can be
+	//computed so far to dst.
+	void process(const StereoSampleFinal *src, size_t count, std::vector<StereoSampleFinal> &dst);
+};
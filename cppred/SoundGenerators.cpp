@@ -1,7 +1,6 @@
 #include "SoundGenerators.h"
 #include "utility.h"
-
-const int int16_max = (1 << 15) - 1;
+#include <algorithm>
 
 const byte_t Square2Generator::duties[4] = {
 	0x80,
@@ -59,6 +58,16 @@ void ClockDivider::update(std::uint64_t source_clock){
 	this->last_update = time;
 }
 
+std::uint64_t ClockDivider::next_update(std::uint64_t source_clock) const{
+	if (!this->src_frequency_power | !this->dst_frequency)
+		return std::numeric_limits<std::uint64_t>::max();
+	if (this->last_update == std::numeric_limits<std::uint64_t>::max())
+		return source_clock;
+	auto target = (this->last_update + 1) << this->src_frequency_power;
+	auto ret = (target + this->dst_frequency - 1) / this->dst_frequency;
+	return std::max(ret, source_clock);
+}
+
 void ClockDivider::reset(){
 	this->last_update = std::numeric_limits<std::uint64_t>::max();
 }
@@ -92,72 +101,6 @@ void Square1Generator::trigger_event(){
 	}
 }
 
-unsigned Square2Generator::get_period(){
-	if (!this->period)
-		this->period = (2048 - this->frequency) * 4;
-	return this->period;
-}
-
-template <unsigned Shift>
-void FrequenciedGenerator::advance_cycle(std::uint64_t time){
-	bool und1 = this->reference_time == this->undefined_reference_time;
-	bool und2 = this->reference_cycle_position == this->undefined_reference_cycle_position;
-	if (und1 & und2){
-		this->reference_time = time;
-		this->reference_cycle_position = this->cycle_position;
-	}else{
-		auto delta = time - this->reference_time;
-		this->cycle_position = this->reference_cycle_position;
-		const auto mult = (std::uint64_t)gb_cpu_frequency << Shift;
-		auto div = sampling_frequency * this->get_period();
-		this->cycle_position += (unsigned)(delta * mult / div) & 0xFFFF;
-		this->cycle_position &= 0xFFFF;
-	}
-}
-
-void Square2Generator::update_state_before_render(std::uint64_t time){
-	this->advance_cycle<13>(time);
-}
-
-intermediate_audio_type Square2Generator::render(std::uint64_t time) const{
-	if (!this->enabled())
-		return 0;
-
-	bool bit = !!(this->duties[this->selected_duty] & ::bit(this->cycle_position >> 13));
-	return this->render_from_bit(bit);
-}
-
-intermediate_audio_type EnvelopedGenerator::render_from_bit(bool signal) const{
-#ifdef USE_FLOAT_AUDIO
-	auto y = (signal * 2 - 1) * this->volume;
-	return (intermediate_audio_type)y * (1.f / 15.f);
-#else
-	auto y = (signal * 2 - 1) * this->volume;
-	return y * int16_max / 15;
-#endif
-}
-
-bool WaveformGenerator::enabled() const{
-	return this->length_counter_has_not_finished();
-}
-
-bool WaveformGenerator::length_counter_has_not_finished() const{
-	return !this->length_enable | !!this->sound_length;
-}
-
-bool EnvelopedGenerator::enabled() const{
-	return WaveformGenerator::enabled() & !!this->volume;
-}
-
-bool Square2Generator::enabled() const{
-	//Note: if frequency value > 2041, sound frequency > 20 kHz
-	return EnvelopedGenerator::enabled() & (this->frequency > 0) & (this->frequency <= 2041);
-}
-
-bool Square1Generator::enabled() const{
-	return Square2Generator::enabled() & (this->shadow_frequency != this->audio_disabled_by_sweep);
-}
-
 void FrequenciedGenerator::write_register3_frequency(byte_t value){
 	auto old = this->frequency;
 	this->frequency &= ~(unsigned)0xFF;
@@ -332,6 +275,7 @@ void NoiseGenerator::set_register3(byte_t value){
 	else
 		frequency = (1 << 19) / divisor_code;
 	frequency >>= clock_shift + 1;
+	this->clock_frequency = frequency;
 
 	this->noise_scheduler.configure(
 		gb_cpu_frequency_power,
@@ -348,17 +292,6 @@ void NoiseGenerator::set_register3(byte_t value){
 	);
 }
 
-intermediate_audio_type NoiseGenerator::render(std::uint64_t time) const{
-	if (!this->enabled())
-		return 0;
-
-	return this->render_from_bit(this->output);
-}
-
-void NoiseGenerator::update_state_before_render(std::uint64_t time){
-	this->noise_scheduler.update(time);
-}
-
 void NoiseGenerator::noise_update_event(void *This, std::uint64_t){
 	((NoiseGenerator *)This)->noise_update_event();
 }
@@ -433,36 +366,6 @@ byte_t VoluntaryWaveGenerator::get_register3() const{
 	return 0xFF;
 }
 
-void VoluntaryWaveGenerator::update_state_before_render(std::uint64_t time){
-	this->advance_cycle<11>(time);
-	this->sample_register = this->wave_buffer[this->cycle_position >> 11];
-}
-
-intermediate_audio_type VoluntaryWaveGenerator::render(std::uint64_t time) const{
-	if (!this->enabled())
-		return 0;
-
-#ifdef USE_FLOAT_AUDIO
-	return (this->sample_register >> this->volume_shift) * (2.f / 15.f) - 1;
-#else
-	auto ret = this->sample_register >> this->volume_shift;
-	ret *= 2 * int16_max;
-	ret /= 15;
-	ret -= int16_max;
-	return ret;
-#endif
-}
-
-unsigned VoluntaryWaveGenerator::get_period(){
-	if (!this->period)
-		this->period = (2048 - this->frequency) * 2;
-	return this->period;
-}
-
-bool VoluntaryWaveGenerator::enabled() const{
-	return WaveformGenerator::enabled() & (this->volume_shift != 4) & !!this->frequency & this->dac_power;
-}
-
 void VoluntaryWaveGenerator::trigger_event(){
 	WaveformGenerator::trigger_event();
 	this->cycle_position = 0;
@@ -1,8 +1,12 @@
 #pragma once
 #include "common_types.h"
 #include "AudioData.h"
+#include "BlepBuffer.h"
+#include "utility.h"
 #include <limits>
 
+const int int16_max = (1 << 15) - 1;
+
 class ClockDivider{
 public:
 #ifdef USE_STD_FUNCTION
@@ -28,6 +32,9 @@ public:
 	void configure(unsigned src_frequency_power, std::uint64_t dst_frequency, callback_t callback, void *user_data);
 #endif
 	void update(std::uint64_t);
+	//Returns the earliest source clock >= source_clock at which update() would
+	//invoke the callback.
+	std::uint64_t next_update(std::uint64_t source_clock) const;
 	void reset();
 };
 
@@ -41,7 +48,9 @@ protected:
 	bool length_enable = false;
 
 	virtual void trigger_event();
-	virtual bool enabled() const;
+	virtual bool enabled() const{
+		return this->length_counter_has_not_finished();
+	}
 public:
 	WaveformGenerator();
 	virtual ~WaveformGenerator(){}
@@ -62,7 +71,13 @@ public:
 	}
 	byte_t get_register4() const;
 	void length_counter_event();
-	bool length_counter_has_not_finished() const;
+	bool length_counter_has_not_finished() const{
+		return !this->length_enable | !!this->sound_length;
+	}
+	//A channel that isn't active outputs 0.
+	bool is_active() const{
+		return this->enabled();
+	}
 };
 
 class EnvelopedGenerator : public WaveformGenerator{
@@ -73,9 +88,18 @@ protected:
 	unsigned envelope_time = 0;
 	int volume = 0;
 
-	virtual bool enabled() const override;
+	virtual bool enabled() const override{
+		return WaveformGenerator::enabled() & !!this->volume;
+	}
 	virtual void trigger_event() override;
-	intermediate_audio_type render_from_bit(bool signal) const;
+	intermediate_audio_type render_from_bit(bool signal) const{
+		auto y = (signal * 2 - 1) * this->volume;
+#ifdef USE_FLOAT_AUDIO
+		return (intermediate_audio_type)y * (1.f / 15.f);
+#else
+		return y * int16_max / 15;
+#endif
+	}
 	void load_volume_from_register();
 public:
 	virtual ~EnvelopedGenerator(){}
@@ -91,16 +115,82 @@ protected:
 	std::uint64_t reference_time = 0;
 	unsigned cycle_position = 0;
 	unsigned reference_cycle_position = 0;
+	//Cycles elapsed since reference_time are (time - reference_time) * mult /
+	//divisor. Consecutive samples add the precomputed quotient and remainder
+	//of mult / divisor instead of dividing. Only the low 16 bits of the
+	//quotient are kept, since that's all cycle_position uses.
+	std::uint64_t last_time = 0;
+	std::uint64_t elapsed_cycles = 0;
+	std::uint64_t elapsed_remainder = 0;
+	std::uint64_t cycle_increment = 0;
+	std::uint64_t remainder_increment = 0;
+	std::uint64_t divisor = 1;
+#ifdef USE_BAND_LIMITED_SYNTHESIS
+	//cycle_position with 16 more bits of precision.
+	std::uint32_t phase = 0;
+#endif
 	const decltype(reference_time) undefined_reference_time = std::numeric_limits<decltype(reference_time)>::max();
 	const decltype(reference_cycle_position) undefined_reference_cycle_position = std::numeric_limits<decltype(reference_cycle_position)>::max();
 
 	template <unsigned Shift>
-	void advance_cycle(std::uint64_t time);
+	void advance_cycle(std::uint64_t time, unsigned period){
+		const auto mult = (std::uint64_t)gb_cpu_frequency << Shift;
+		bool und1 = this->reference_time == this->undefined_reference_time;
+		bool und2 = this->reference_cycle_position == this->undefined_reference_cycle_position;
+		if (und1 & und2){
+			//The references are reset by every frequency change, so this is the
+			//only place where the period can change.
+			this->reference_time = time;
+			this->reference_cycle_position = this->cycle_position;
+			this->divisor = (std::uint64_t)synthesis_frequency * period;
+			this->cycle_increment = mult / this->divisor;
+			this->remainder_increment = mult % this->divisor;
+			this->last_time = time;
+			this->elapsed_cycles = 0;
+			this->elapsed_remainder = 0;
+			return;
+		}
+		if (time == this->last_time + 1){
+			auto remainder = this->elapsed_remainder + this->remainder_increment;
+			std::uint64_t carry = remainder >= this->divisor;
+			this->elapsed_remainder = remainder - (this->divisor & (0 - carry));
+			this->elapsed_cycles = (this->elapsed_cycles + this->cycle_increment + carry) & 0xFFFF;
+		}else if (time != this->last_time){
+			//Samples were skipped (e.g. while the master toggle was off).
+			auto delta = time - this->reference_time;
+			this->elapsed_cycles = delta * mult / this->divisor & 0xFFFF;
+			this->elapsed_remainder = delta * mult % this->divisor;
+		}
+		this->last_time = time;
+		this->cycle_position = (this->reference_cycle_position + (unsigned)this->elapsed_cycles) & 0xFFFF;
+	}
 	void frequency_change(unsigned old_frequency);
-	virtual unsigned get_period() = 0;
 	void write_register3_frequency(byte_t value);
 	void write_register4_frequency(byte_t value);
 	void reset_references();
+#ifdef USE_BAND_LIMITED_SYNTHESIS
+	void sync_phase(){
+		//Triggers reset cycle_position.
+		if (this->phase >> 16 != this->cycle_position)
+			this->phase = this->cycle_position << 16;
+	}
+	//Advances the phase by the given number of samples. Calls f(offset, position)
+	//every time the cycle position crosses into one of the 1 << StepBits steps
+	//of a cycle, where offset is the time of the crossing relative to the sample
+	//before the run, in 1/BlepBuffer::phases sample units.
+	template <unsigned Shift, unsigned StepBits, typename F>
+	void advance_phase(unsigned samples, unsigned period, F &&f){
+		const auto mult = (std::uint64_t)gb_cpu_frequency << Shift << 16;
+		auto increment = mult / ((std::uint64_t)synthesis_frequency * period);
+		const std::uint64_t step = (std::uint64_t)1 << (32 - StepBits);
+		std::uint64_t start = this->phase;
+		auto end = start + increment * samples;
+		for (auto boundary = (start | (step - 1)) + 1; boundary <= end; boundary += step)
+			f((unsigned)(((boundary - start) << blep_phase_bits) / increment), (unsigned)(boundary >> 16) & 0xFFFF);
+		this->phase = (std::uint32_t)end;
+		this->cycle_position = this->phase >> 16;
+	}
+#endif
 public:
 	virtual ~FrequenciedGenerator(){}
 };
@@ -110,13 +200,41 @@ protected:
 	unsigned selected_duty = 2;
 	static const byte_t duties[4];
 
-	unsigned get_period() override;
-	virtual bool enabled() const override;
+	unsigned get_period(){
+		if (!this->period)
+			this->period = (2048 - this->frequency) * 4;
+		return this->period;
+	}
+	virtual bool enabled() const override{
+		//Note: if frequency value > 2041, sound frequency > 20 kHz
+		return EnvelopedGenerator::enabled() & (this->frequency > 0) & (this->frequency <= 2041);
+	}
 	void trigger_event() override;
+	intermediate_audio_type render_duty() const{
+		return this->render_from_bit(!!(this->duties[this->selected_duty] & ::bit(this->cycle_position >> 13)));
+	}
 public:
 	virtual ~Square2Generator(){}
-	void update_state_before_render(std::uint64_t time) override;
-	intermediate_audio_type render(std::uint64_t time) const override;
+	void update_state_before_render(std::uint64_t time) override{
+		this->advance_cycle<13>(time, this->get_period());
+	}
+	intermediate_audio_type render(std::uint64_t time) const override{
+		return this->Square2Generator::enabled() ? this->render_duty() : 0;
+	}
+#ifdef USE_BAND_LIMITED_SYNTHESIS
+	//Calls f(offset, level) with the level at the start of the run and at every
+	//step of the duty cycle during the next samples.
+	template <typename F>
+	void render_steps(unsigned samples, F &&f){
+		this->sync_phase();
+		f(0, this->render(0));
+		bool enabled = this->enabled();
+		auto duty = this->duties[this->selected_duty];
+		this->advance_phase<13, 3>(samples, this->get_period(), [&](unsigned offset, unsigned position){
+			f(offset, enabled ? this->render_from_bit(!!(duty & ::bit(position >> 13))) : 0);
+		});
+	}
+#endif
 
 	virtual void set_register1(byte_t value) override;
 	virtual void set_register3(byte_t value) override;
@@ -125,7 +243,7 @@ public:
 	virtual byte_t get_register3() const override;
 };
 
-class Square1Generator : public Square2Generator{
+class Square1Generator final : public Square2Generator{
 	unsigned sweep_period = 0;
 	unsigned sweep_time = 0;
 	int sweep_sign = 0;
@@ -134,18 +252,24 @@ class Square1Generator : public Square2Generator{
 	static const unsigned audio_disabled_by_sweep = 2048;
 	std::uint64_t last_sweep = 0;
 
-	bool enabled() const override;
+	bool enabled() const override{
+		return Square2Generator::enabled() & (this->shadow_frequency != this->audio_disabled_by_sweep);
+	}
 	void trigger_event() override;
 public:
+	intermediate_audio_type render(std::uint64_t time) const override{
+		return this->Square1Generator::enabled() ? this->render_duty() : 0;
+	}
 	void set_register0(byte_t value);
 	byte_t get_register0() const;
 	void sweep_event(bool force = false);
 };
 
-class NoiseGenerator : public EnvelopedGenerator{
+class NoiseGenerator final : public EnvelopedGenerator{
 	unsigned width_mode = 14;
 	unsigned noise_register = 1;
 	bool output = true;
+	unsigned clock_frequency = 0;
 
 	ClockDivider noise_scheduler;
 
@@ -154,23 +278,87 @@ class NoiseGenerator : public EnvelopedGenerator{
 	void trigger_event() override;
 public:
 	void set_register3(byte_t value) override;
-	intermediate_audio_type render(std::uint64_t time) const override;
-	void update_state_before_render(std::uint64_t time) override;
+	intermediate_audio_type render(std::uint64_t time) const override{
+		return this->enabled() ? this->render_from_bit(this->output) : 0;
+	}
+	//The LFSR runs on the CPU clock, unlike the rest of the per-sample state.
+	void update_lfsr(std::uint64_t time){
+		this->noise_scheduler.update(time);
+	}
+#ifdef USE_BAND_LIMITED_SYNTHESIS
+	//Calls f(offset, level) with the level at the start of the run and after
+	//every LFSR step during the samples [first_sample, first_sample + samples)
+	//of the audio sample clock.
+	template <typename F>
+	void render_steps(std::uint64_t first_sample, unsigned samples, F &&f){
+		f(0, this->render(0));
+		if (!this->clock_frequency)
+			return;
+		//Ticks are derived from the sample clock, so each run picks up where the
+		//previous one stopped.
+		auto origin = first_sample - !!first_sample;
+		auto first_tick = origin * this->clock_frequency / synthesis_frequency;
+		auto last_tick = (origin + samples) * this->clock_frequency / synthesis_frequency;
+		bool enabled = this->enabled();
+		for (auto tick = first_tick + 1; tick <= last_tick; tick++){
+			this->noise_update_event();
+			auto time = (tick * synthesis_frequency << blep_phase_bits) / this->clock_frequency;
+			f((unsigned)(time - (origin << blep_phase_bits)), enabled ? this->render_from_bit(this->output) : 0);
+		}
+	}
+#endif
 };
 
-class VoluntaryWaveGenerator : public WaveformGenerator, public FrequenciedGenerator{
+class VoluntaryWaveGenerator final : public WaveformGenerator, public FrequenciedGenerator{
 	bool dac_power = false;
 	unsigned volume_shift = 0;
 	byte_t wave_buffer[32];
 	byte_t sample_register = 0;
 
-	bool enabled() const override;
+	bool enabled() const override{
+		return WaveformGenerator::enabled() & (this->volume_shift != 4) & !!this->frequency & this->dac_power;
+	}
+	intermediate_audio_type render_sample() const{
+#ifdef USE_FLOAT_AUDIO
+		return (this->sample_register >> this->volume_shift) * (2.f / 15.f) - 1;
+#else
+		auto ret = this->sample_register >> this->volume_shift;
+		ret *= 2 * int16_max;
+		ret /= 15;
+		ret -= int16_max;
+		return ret;
+#endif
+	}
 	void trigger_event() override;
 public:
 	VoluntaryWaveGenerator();
-	void update_state_before_render(std::uint64_t time) override;
-	intermediate_audio_type render(std::uint64_t time) const override;
-	unsigned get_period() override;
+	void update_state_before_render(std::uint64_t time) override{
+		this->advance_cycle<11>(time, this->get_period());
+		this->sample_register = this->wave_buffer[this->cycle_position >> 11];
+	}
+	intermediate_audio_type render(std::uint64_t time) const override{
+		return this->enabled() ? this->render_sample() : 0;
+	}
+	unsigned get_period(){
+		if (!this->period)
+			this->period = (2048 - this->frequency) * 2;
+		return this->period;
+	}
+#ifdef USE_BAND_LIMITED_SYNTHESIS
+	//Calls f(offset, level) with the level at the start of the run and at every
+	//step of the wave table during the next samples.
+	template <typename F>
+	void render_steps(unsigned samples, F &&f){
+		this->sync_phase();
+		this->sample_register = this->wave_buffer[this->cycle_position >> 11];
+		f(0, this->render(0));
+		bool enabled = this->enabled();
+		this->advance_phase<11, 5>(samples, this->get_period(), [&](unsigned offset, unsigned position){
+			this->sample_register = this->wave_buffer[position >> 11];
+			f(offset, enabled ? this->render_sample() : 0);
+		});
+	}
+#endif
 
 	void set_register0(byte_t);
 	void set_register1(byte_t) override;
@@ -189,4 +377,8 @@ class CapacitorFilter{
 	intermediate_audio_type state = 0;
 public:
 	intermediate_audio_type update(intermediate_audio_type in);
+	//The output stays at 0 for as long as the input does.
+	bool is_discharged() const{
+		return !this->state;
+	}
 };
@@ -1,31 +1,95 @@
 #include "Sprite.h"
 #include "Renderer.h"
+#include <algorithm>
+#include <cassert>
+
+int SpritePool::add(Sprite &sprite, std::uint64_t id, int w, int h){
+	//IDs are handed out in increasing order, so appending keeps the slots
+	//sorted.
+	assert(!this->ids.size() || this->ids.back() < id);
+	int slot = (int)this->size();
+	this->handles.push_back(&sprite);
+	this->ids.push_back(id);
+	this->xs.push_back(0);
+	this->ys.push_back(0);
+	this->ws.push_back(w);
+	this->hs.push_back(h);
+	this->visible.push_back(false);
+	this->registered.push_back(true);
+	this->palettes.push_back(null_palette);
+	this->palette_regions.push_back(PaletteRegion::Sprites0);
+	this->first_tiles.push_back(this->tiles.size());
+	this->tiles.resize(this->tiles.size() + w * h);
+	this->order.push_back(slot);
+	return slot;
+}
+
+template <typename T>
+static void erase_slot(std::vector<T> &v, int slot){
+	v.erase(v.begin() + slot);
+}
+
+void SpritePool::remove(int slot){
+	auto first = this->tiles.begin() + this->first_tiles[slot];
+	size_t tile_count = this->ws[slot] * this->hs[slot];
+	this->tiles.erase(first, first + tile_count);
+	for (size_t i = slot + 1; i < this->size(); i++)
+		this->first_tiles[i] -= tile_count;
+
+	erase_slot(this->handles, slot);
+	erase_slot(this->ids, slot);
+	erase_slot(this->xs, slot);
+	erase_slot(this->ys, slot);
+	erase_slot(this->ws, slot);
+	erase_slot(this->hs, slot);
+	erase_slot(this->visible, slot);
+	erase_slot(this->registered, slot);
+	erase_slot(this->palettes, slot);
+	erase_slot(this->palette_regions, slot);
+	erase_slot(this->first_tiles, slot);
+	for (size_t i = slot; i < this->size(); i++)
+		this->handles[i]->slot = (int)i;
+
+	this->order.erase(std::find(this->order.begin(), this->order.end(), slot));
+	for (auto &i : this->order)
+		if (i > slot)
+			i--;
+}
+
+//Sprites are drawn from right to left, and from oldest to newest when they
+//share the same x. Positions change little from one frame to the next, so the
+//order is maintained with an insertion sort, which is linear when the order
+//is already sorted or nearly so.
+void SpritePool::sort_order(){
+	auto &xs = this->xs;
+	auto &ids = this->ids;
+	auto goes_before = [&xs, &ids](int a, int b){
+		if (xs[a] != xs[b])
+			return xs[a] > xs[b];
+		return ids[a] < ids[b];
+	};
+	for (size_t i = 1; i < this->order.size(); i++){
+		auto slot = this->order[i];
+		auto j = i;
+		for (; j > 0 && goes_before(slot, this->order[j - 1]); j--)
+			this->order[j] = this->order[j - 1];
+		this->order[j] = slot;
+	}
+}
 
 Sprite::Sprite(Renderer &owner, int w, int h){
 	if (w <= 0 || h <= 0)
 		throw std::runtime_error("Sprite::Sprite(): Size must be >= 1x1");
-	this->owner = &owner;
-	this->id = owner.get_id();
-	this->y = this->x = 0;
-	this->w = w;
-	this->h = h;
-	this->tiles.resize(w * h);
-
-	SpriteTile tile;
-	tile.tile_no = 0;
-	tile.flipped_x = false;
-	tile.flipped_y = false;
-	tile.has_priority = false;
-	fill(this->tiles, tile);
+	this->pool = &owner.get_sprite_pool();
+	this->slot = this->pool->add(*this, owner.get_id(), w, h);
 }
 
 Sprite::~Sprite(){
-	if (this->owner)
-		this->owner->release_sprite(this->id);
+	this->pool->remove(this->slot);
 }
 
 SpriteTile &Sprite::get_tile(int x, int y){
-	if ((x < 0) | (y < 0) | (x >= this->w) | (y >= this->h))
+	if ((x < 0) | (y < 0) | (x >= this->get_w()) | (y >= this->get_h()))
 		throw std::runtime_error("Invalid coordinates.");
-	return this->tiles[x + y * this->w];
+	return this->pool->get_tiles(this->slot)[x + y * this->get_w()];
 }
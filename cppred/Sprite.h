@@ -3,15 +3,48 @@
 #include "RendererStructs.h"
 
 class Renderer;
+class Sprite;
 
-class Sprite{
-	Renderer *owner;
-	std::uint64_t id;
-	int x, y, w, h;
-	bool visible = false;
-	Palette palette = null_palette;
-	PaletteRegion palette_region = PaletteRegion::Sprites0;
+//Dense store for the state of all the sprites of a Renderer. Each attribute is
+//kept in its own array, indexed by slot, and slots are kept sorted by ID. The
+//tiles of all the sprites share a single arena. Note that adding a sprite may
+//invalidate references to the tiles of other sprites.
+class SpritePool{
+public:
+	std::vector<Sprite *> handles;
+	std::vector<std::uint64_t> ids;
+	std::vector<int> xs;
+	std::vector<int> ys;
+	std::vector<int> ws;
+	std::vector<int> hs;
+	std::vector<bool> visible;
+	std::vector<bool> registered;
+	std::vector<Palette> palettes;
+	std::vector<PaletteRegion> palette_regions;
+	std::vector<size_t> first_tiles;
 	std::vector<SpriteTile> tiles;
+	//Slots in drawing order. Only valid after calling sort_order().
+	std::vector<int> order;
+
+	size_t size() const{
+		return this->ids.size();
+	}
+	int add(Sprite &, std::uint64_t id, int w, int h);
+	void remove(int slot);
+	void sort_order();
+	SpriteTile *get_tiles(int slot){
+		return &this->tiles[this->first_tiles[slot]];
+	}
+	const SpriteTile *get_tiles(int slot) const{
+		return &this->tiles[this->first_tiles[slot]];
+	}
+};
+
+//Handle to a sprite stored in a SpritePool.
+class Sprite{
+	friend class SpritePool;
+	SpritePool *pool;
+	int slot;
 public:
 	Sprite(Renderer &, int w, int h);
 	~Sprite();
@@ -20,23 +53,55 @@ public:
 	void operator=(const Sprite &) = delete;
 	void operator=(Sprite &&) = delete;
 	SpriteTile &get_tile(int x, int y);
-	iterator_pair<decltype(tiles)> iterate_tiles(){
-		return { this->tiles.begin(), this->tiles.end() };
+	std::pair<SpriteTile *, SpriteTile *> iterate_tiles(){
+		auto tiles = this->pool->get_tiles(this->slot);
+		return { tiles, tiles + this->get_w() * this->get_h() };
 	}
 
-	DEFINE_GETTER(id)
-	DEFINE_GETTER_SETTER(x)
-	DEFINE_GETTER_SETTER(y)
-	DEFINE_GETTER(w)
-	DEFINE_GETTER(h)
-	DEFINE_GETTER_SETTER(visible)
-	DEFINE_GETTER_SETTER(palette)
-	DEFINE_GETTER_SETTER(palette_region)
+	std::uint64_t get_id() const{
+		return this->pool->ids[this->slot];
+	}
+	int get_x() const{
+		return this->pool->xs[this->slot];
+	}
+	void set_x(int x){
+		this->pool->xs[this->slot] = x;
+	}
+	int get_y() const{
+		return this->pool->ys[this->slot];
+	}
+	void set_y(int y){
+		this->pool->ys[this->slot] = y;
+	}
+	int get_w() const{
+		return this->pool->ws[this->slot];
+	}
+	int get_h() const{
+		return this->pool->hs[this->slot];
+	}
+	bool get_visible() const{
+		return this->pool->visible[this->slot];
+	}
+	void set_visible(bool visible){
+		this->pool->visible[this->slot] = visible;
+	}
+	const Palette &get_palette() const{
+		return this->pool->palettes[this->slot];
+	}
+	void set_palette(const Palette &palette){
+		this->pool->palettes[this->slot] = palette;
+	}
+	PaletteRegion get_palette_region() const{
+		return this->pool->palette_regions[this->slot];
+	}
+	void set_palette_region(PaletteRegion palette_region){
+		this->pool->palette_regions[this->slot] = palette_region;
+	}
 	void set_position(const Point &p){
-		this->x = p.x;
-		this->y = p.y;
+		this->set_x(p.x);
+		this->set_y(p.y);
 	}
 	Point get_position(){
-		return { this->x, this->y };
+		return { this->get_x(), this->get_y() };
 	}
 };
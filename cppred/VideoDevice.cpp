@@ -1,11 +1,16 @@
 #include "VideoDevice.h"
 #include <string>
 
-VideoDevice::VideoDevice(const Point &size):
+VideoDevice::VideoDevice(const Point &size, bool headless):
 		window(nullptr, SDL_DestroyWindow),
-		renderer(nullptr, SDL_DestroyRenderer){
-	this->window.reset(SDL_CreateWindow("", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, size.x, size.y, 0));
+		renderer(nullptr, SDL_DestroyRenderer),
+		headless(headless){
 	this->screen_size = size;
+	//A headless device has no window. Textures are kept in system memory and
+	//copying and presenting are no-ops.
+	if (this->headless)
+		return;
+	this->window.reset(SDL_CreateWindow("", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, size.x, size.y, 0));
 	if (!this->window)
 		throw std::runtime_error("Failed to initialize SDL window.");
 	this->renderer.reset(SDL_CreateRenderer(window.get(), -1, SDL_RENDERER_PRESENTVSYNC));
@@ -14,10 +19,16 @@ VideoDevice::VideoDevice(const Point &size):
 }
 
 void VideoDevice::set_window_title(const char *title){
+	if (this->headless)
+		return;
 	SDL_SetWindowTitle(this->window.get(), title);
 }
 
 Texture VideoDevice::allocate_texture(int w, int h){
+	if (this->headless){
+		std::unique_ptr<RGB[]> pixels(new RGB[w * h]);
+		return { std::move(pixels), {w, h} };
+	}
 	auto t = SDL_CreateTexture(this->renderer.get(), SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, w, h);
 	if (!t)
 		return Texture();
@@ -26,10 +37,14 @@ Texture VideoDevice::allocate_texture(int w, int h){
 }
 
 void VideoDevice::render_copy(const Texture &texture){
+	if (this->headless)
+		return;
 	SDL_RenderCopy(this->renderer.get(), texture.texture.get(), nullptr, nullptr);
 }
 
 void VideoDevice::present(){
+	if (this->headless)
+		return;
 	SDL_RenderPresent(this->renderer.get());
 }
 
@@ -37,15 +52,28 @@ Texture::Texture(): texture(nullptr, SDL_DestroyTexture){}
 
 Texture::Texture(SDL_Texture *t, const Point &size): texture(t, SDL_DestroyTexture), size(size){}
 
-Texture::Texture(Texture &&other): texture(std::move(other.texture)), size(other.size){}
+Texture::Texture(std::unique_ptr<RGB[]> &&pixels, const Point &size):
+	texture(nullptr, SDL_DestroyTexture),
+	software_texture(std::move(pixels)),
+	size(size){}
+
+Texture::Texture(Texture &&other):
+	texture(std::move(other.texture)),
+	software_texture(std::move(other.software_texture)),
+	size(other.size){}
 
 const Texture &Texture::operator=(Texture &&other){
 	this->texture = std::move(other.texture);
+	this->software_texture = std::move(other.software_texture);
 	this->size = other.size;
 	return *this;
 }
 
 bool Texture::try_lock(TextureSurface &dst){
+	if (this->software_texture){
+		dst.lock_software(this->software_texture.get(), this->size);
+		return true;
+	}
 	return !dst.try_lock(this->texture.get(), this->size);
 }
 
@@ -81,6 +109,13 @@ const char *TextureSurface::try_lock(SDL_Texture *texture, const Point &size){
 	return nullptr;
 }
 
+void TextureSurface::lock_software(RGB *pixels, const Point &size){
+	if (this->texture || this->pixels)
+		throw std::runtime_error("TextureSurface::lock_software(): Invalid usage.");
+	this->pixels = pixels;
+	this->size = size;
+}
+
 TextureSurface::TextureSurface(){
 	this->texture = nullptr;
 	this->pixels = nullptr;
@@ -11,6 +11,7 @@ class TextureSurface{
 
 	TextureSurface(SDL_Texture *, const Point &size);
 	const char *try_lock(SDL_Texture *, const Point &size);
+	void lock_software(RGB *, const Point &size);
 public:
 	TextureSurface();
 	TextureSurface(const TextureSurface &) = delete;
@@ -32,9 +33,12 @@ public:
 class Texture{
 	friend class VideoDevice;
 	std::unique_ptr<SDL_Texture, void(*)(SDL_Texture *)> texture;
+	//Only used by headless devices, in place of an SDL texture.
+	std::unique_ptr<RGB[]> software_texture;
 	Point size;
 	
 	Texture(SDL_Texture *, const Point &size);
+	Texture(std::unique_ptr<RGB[]> &&, const Point &size);
 public:
 	Texture();
 	Texture(const Texture &) = delete;
@@ -44,7 +48,7 @@ public:
 	TextureSurface lock();
 	bool try_lock(TextureSurface &dst);
 	bool operator!() const{
-		return !this->texture;
+		return !this->texture && !this->software_texture;
 	}
 	const Point &get_size() const{
 		return this->size;
@@ -55,12 +59,16 @@ class VideoDevice{
 	std::unique_ptr<SDL_Window, void (*)(SDL_Window *)> window;
 	std::unique_ptr<SDL_Renderer, void (*)(SDL_Renderer *)> renderer;
 	Point screen_size;
+	bool headless;
 public:
-	VideoDevice(const Point &size);
+	VideoDevice(const Point &size, bool headless = false);
 	void set_window_title(const char *);
 	Point get_screen_size() const{
 		return this->screen_size;
 	}
+	bool get_headless() const{
+		return this->headless;
+	}
 	Texture allocate_texture(int w, int h);
 	Texture allocate_texture(const Point &p){
 		return this->allocate_texture(p.x, p.y);
@@ -0,0 +1,40 @@
+#include "WorkerPool.h"
+#include <algorithm>
+
+WorkerPool::WorkerPool(unsigned threads){
+	if (!threads)
+		threads = std::max(std::thread::hardware_concurrency(), 1U);
+	for (unsigned i = 1; i < threads; i++){
+		this->workers.emplace_back(new Worker);
+		auto &worker = *this->workers.back();
+		worker.thread.reset(new std::thread([this, &worker, i](){ this->thread_func(worker, (int)i); }));
+	}
+}
+
+WorkerPool::~WorkerPool(){
+	this->stop = true;
+	for (auto &worker : this->workers)
+		worker->start.signal();
+	for (auto &worker : this->workers)
+		join_thread(worker->thread);
+}
+
+void WorkerPool::thread_func(Worker &worker, int band){
+	while (true){
+		worker.start.wait();
+		if (this->stop)
+			break;
+		(*this->job)(band);
+		worker.done.signal();
+	}
+}
+
+void WorkerPool::run(const std::function<void(int)> &job){
+	this->job = &job;
+	for (auto &worker : this->workers)
+		worker->start.signal();
+	job(0);
+	for (auto &worker : this->workers)
+		worker->done.wait();
+	this->job = nullptr;
+}
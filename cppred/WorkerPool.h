@@ -0,0 +1,40 @@
+#pragma once
+
+#include "threads.h"
+#include <functional>
+#include <memory>
+#include <vector>
+
+//Runs jobs split into bands over a fixed set of threads. The calling thread
+//always runs band 0.
+class WorkerPool{
+	struct Worker{
+		std::unique_ptr<std::thread> thread;
+		Event start;
+		Event done;
+	};
+	std::vector<std::unique_ptr<Worker>> workers;
+	const std::function<void(int)> *job = nullptr;
+	bool stop = false;
+
+	void thread_func(Worker &, int band);
+public:
+	//threads counts the calling thread. 0 means one thread per core.
+	WorkerPool(unsigned threads);
+	~WorkerPool();
+	WorkerPool(const WorkerPool &) = delete;
+	WorkerPool(WorkerPool &&) = delete;
+	void operator=(const WorkerPool &) = delete;
+	void operator=(WorkerPool &&) = delete;
+	int get_bands() const{
+		return (int)this->workers.size() + 1;
+	}
+	//Returns the range [first, second) of [0, n) that belongs to band.
+	std::pair<int, int> get_band(int band, int n) const{
+		auto bands = this->get_bands();
+		return { n * band / bands, n * (band + 1) / bands };
+	}
+	//Calls job(band) for every band, each in its own thread, and returns once
+	//all of them have finished.
+	void run(const std::function<void(int)> &job);
+};
@@ -1,11 +1,164 @@
 #include "Engine.h"
+#include "OfflineAudio.h"
+#include "AudioWorkerPool.h"
+#include "AudioCache.h"
 #include <SDL_main.h>
 #include <stdexcept>
 #include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+
+struct EngineGroupOptions{
+	//Number of engines run side by side. If more than one and they are not
+	//headless, the audio of all of them is stepped by a single AudioWorkerPool.
+	unsigned engines = 1;
+	//Threads of that pool. 0 if --audio-threads wasn't given, which means one.
+	unsigned audio_threads = 0;
+};
+
+//Returns the value of an option of the form --name=value, or nullptr if arg is
+//a different option.
+static const char *get_option_value(const char *arg, const char *name){
+	auto n = strlen(name);
+	if (strncmp(arg, name, n) || arg[n] != '=')
+		return nullptr;
+	return arg + n + 1;
+}
+
+static long long parse_int(const char *option, const char *value, long long min){
+	char *end;
+	auto ret = strtoll(value, &end, 10);
+	if (!*value || *end || ret < min)
+		throw std::runtime_error((std::string)"Invalid value for " + option + ": " + value);
+	return ret;
+}
+
+static Upscaler parse_upscaler(const char *value){
+	if (!strcmp(value, "none"))
+		return Upscaler::None;
+	if (!strcmp(value, "nearest"))
+		return Upscaler::Nearest;
+	if (!strcmp(value, "scale2x"))
+		return Upscaler::Scale2x;
+	throw std::runtime_error((std::string)"Invalid value for --upscaler: " + value);
+}
+
+//If --render-audio is given, render_audio receives the resource name, and
+//offline the options to render it with.
+static EngineOptions parse_options(int argc, char **argv, std::string &render_audio, OfflineAudioOptions &offline, EngineGroupOptions &group){
+	EngineOptions ret;
+	for (int i = 1; i < argc; i++){
+		const char *value;
+		if (!strcmp(argv[i], "--headless"))
+			ret.headless = true;
+		else if ((value = get_option_value(argv[i], "--scale")))
+			ret.screen_scale = (int)parse_int("--scale", value, 1);
+		else if ((value = get_option_value(argv[i], "--upscaler")))
+			ret.upscaler = parse_upscaler(value);
+		else if ((value = get_option_value(argv[i], "--render-threads")))
+			ret.render_threads = (unsigned)parse_int("--render-threads", value, 0);
+		else if ((value = get_option_value(argv[i], "--input-script")))
+			ret.input_script = value;
+		else if ((value = get_option_value(argv[i], "--record-input")))
+			ret.record_input = value;
+		else if ((value = get_option_value(argv[i], "--frame-hashes")))
+			ret.frame_hashes = value;
+		else if ((value = get_option_value(argv[i], "--frames")))
+			ret.frames = parse_int("--frames", value, 1);
+		else if (!strcmp(argv[i], "--pull-audio"))
+			ret.pull_audio = true;
+		else if (!strcmp(argv[i], "--sample-accurate-audio"))
+			ret.sample_accurate_audio = true;
+		else if (!strcmp(argv[i], "--audio-cache"))
+			ret.audio_cache = true;
+		else if ((value = get_option_value(argv[i], "--audio-frame-length")))
+			ret.audio_buffers.frame_length = (unsigned)parse_int("--audio-frame-length", value, 1);
+		else if ((value = get_option_value(argv[i], "--audio-queue-depth")))
+			ret.audio_buffers.queue_depth = (unsigned)parse_int("--audio-queue-depth", value, 1);
+		else if ((value = get_option_value(argv[i], "--audio-latency")))
+			ret.audio_buffers.latency_frames = (unsigned)parse_int("--audio-latency", value, 1);
+		else if ((value = get_option_value(argv[i], "--audio-frequency")))
+			ret.audio_buffers.frequency = (unsigned)parse_int("--audio-frequency", value, 1000);
+		else if ((value = get_option_value(argv[i], "--record-audio")))
+			ret.record_audio = value;
+		else if (!strcmp(argv[i], "--audio-stems"))
+			ret.audio_stems = true;
+		else if ((value = get_option_value(argv[i], "--audio-stats")))
+			ret.audio_stats = value;
+		else if ((value = get_option_value(argv[i], "--render-audio")))
+			render_audio = value;
+		else if ((value = get_option_value(argv[i], "--audio-duration")))
+			offline.max_duration = (double)parse_int("--audio-duration", value, 1);
+		else if ((value = get_option_value(argv[i], "--engines")))
+			group.engines = (unsigned)parse_int("--engines", value, 1);
+		else if ((value = get_option_value(argv[i], "--audio-threads")))
+			group.audio_threads = (unsigned)parse_int("--audio-threads", value, 1);
+		else
+			throw std::runtime_error((std::string)"Unknown option: " + argv[i]);
+	}
+	if (ret.audio_buffers.frame_length > AudioFrame::max_length)
+		throw std::runtime_error("--audio-frame-length can't be greater than " + std::to_string(AudioFrame::max_length));
+	if (render_audio.size() && ret.record_audio.empty())
+		throw std::runtime_error("--render-audio requires --record-audio.");
+	//Every engine would write to the same files.
+	if (group.engines > 1 && (ret.record_input.size() || ret.frame_hashes.size() || ret.record_audio.size() || ret.audio_stats.size()))
+		throw std::runtime_error("--engines can't be combined with options that save files.");
+	//Headless engines step their audio from their own main loops, and a single
+	//engine doesn't share a pool.
+	if (group.audio_threads && (ret.headless || group.engines < 2))
+		throw std::runtime_error("--audio-threads requires --engines greater than 1, and can't be combined with --headless.");
+	offline.buffers = ret.audio_buffers;
+	offline.stems = ret.audio_stems;
+	offline.sample_accurate = ret.sample_accurate_audio;
+	return ret;
+}
+
+//Steps every engine one frame at a time, in turn, until all of them have
+//stopped.
+static void run_engines(EngineOptions options, const EngineGroupOptions &group){
+	//Declared before the engines, since it must outlive their schedulers.
+	std::unique_ptr<AudioWorkerPool> pool;
+	if (!options.headless){
+		pool.reset(new AudioWorkerPool(group.audio_threads));
+		options.audio_pool = pool.get();
+	}
+	//One per version, shared by every engine. Also declared before them.
+	std::unique_ptr<AudioCache> caches[2];
+	if (options.audio_cache){
+		for (int i = 0; i < 2; i++){
+			caches[i].reset(new AudioCache((PokemonVersion)i));
+			options.shared_audio_caches[i] = caches[i].get();
+		}
+	}
+	std::vector<std::unique_ptr<Engine>> engines;
+	for (unsigned i = 0; i < group.engines; i++)
+		engines.emplace_back(new Engine(options));
+	for (std::uint64_t frame = 0; engines.size() && (!options.frames || frame < options.frames); frame++){
+		for (size_t i = 0; i < engines.size();){
+			if (engines[i]->step())
+				i++;
+			else
+				engines.erase(engines.begin() + i);
+		}
+	}
+}
 
 int main(int argc, char **argv){
 	try{
-		Engine engine;
+		std::string render_audio;
+		OfflineAudioOptions offline;
+		EngineGroupOptions group;
+		auto options = parse_options(argc, argv, render_audio, offline, group);
+		if (render_audio.size()){
+			render_audio_offline(render_audio, options.record_audio, offline);
+			return 0;
+		}
+		if (group.engines > 1){
+			run_engines(options, group);
+			return 0;
+		}
+		Engine engine(options);
 		engine.run();
 	}catch (std::exception &e){
 		std::cerr << e.what() << std::endl;
@@ -1,6 +1,8 @@
 #pragma once
 #include "common_types.h"
 #include <array>
+#include <cstddef>
+#include <string>
 #include <vector>
 
 #define BITMAP(x) (bits_from_u32<0x##x>::value)
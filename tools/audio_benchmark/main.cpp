@@ -0,0 +1,144 @@
+//Measures the cost of synthesizing an AudioFrame with the channel generators
+//called through their vtables (VirtualChannel) and with the calls resolved at
+//compile time (StaticChannel). Both pipelines render the same state, so they
+//must produce the same output. Also measures the cost of resampling a frame
+//to a typical device rate.
+//Usage: audio_benchmark [frames]
+
+#include "ChannelPipeline.h"
+#include "Resampler.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+struct Channels{
+	Square1Generator square1;
+	Square2Generator square2;
+	VoluntaryWaveGenerator wave;
+	NoiseGenerator noise;
+
+	Channels(){
+		this->square1.set_register1(0x80);
+		this->square1.set_register2(0xF3);
+		this->square1.set_register3(0x83);
+		this->square1.set_register4(0x87);
+
+		this->square2.set_register1(0x40);
+		this->square2.set_register2(0xA7);
+		this->square2.set_register3(0x21);
+		this->square2.set_register4(0x86);
+
+		for (unsigned i = 0; i < 16; i++)
+			this->wave.set_wave_table(i, (byte_t)(i * 0x11));
+		this->wave.set_register0(0x80);
+		this->wave.set_register2(0x20);
+		this->wave.set_register3(0x06);
+		this->wave.set_register4(0x87);
+
+		this->noise.set_register2(0xF1);
+		this->noise.set_register3(0x35);
+		this->noise.set_register4(0x80);
+	}
+	//Runs the frame sequencer events that HeliosRenderer would, once every
+	//~86 samples.
+	void frame_sequencer_event(std::uint64_t clock){
+		if (!(clock % 2)){
+			this->square1.length_counter_event();
+			this->square2.length_counter_event();
+			this->noise.length_counter_event();
+		}
+		if (clock % 8 == 7){
+			this->square1.volume_event();
+			this->square2.volume_event();
+			this->noise.volume_event();
+		}
+		if (clock % 4 == 2)
+			this->square1.sweep_event();
+	}
+};
+
+template <typename Pipeline>
+double benchmark(const char *name, unsigned frames, std::int64_t &checksum){
+	Channels channels;
+	Pipeline pipeline(channels.square1, channels.square2, channels.wave, channels.noise);
+	Panning panning[4];
+	StereoSampleIntermediate samples[4];
+
+	//The default frame length that HeliosRenderer would use.
+	const auto frame_length = AudioBufferOptions().frame_length;
+	checksum = 0;
+	std::uint64_t sample_no = 0;
+	auto t0 = std::chrono::high_resolution_clock::now();
+	for (unsigned frame = 0; frame < frames; frame++){
+		for (unsigned i = 0; i < frame_length; i++, sample_no++){
+			if (sample_no % (synthesis_frequency / 512) == 0)
+				channels.frame_sequencer_event(sample_no / (synthesis_frequency / 512));
+			channels.noise.update_lfsr(sample_no * gb_cpu_frequency / synthesis_frequency);
+			pipeline.render(sample_no, panning, samples);
+			for (auto &sample : samples)
+				checksum += sample.left + sample.right;
+		}
+	}
+	auto t1 = std::chrono::high_resolution_clock::now();
+	auto ret = std::chrono::duration<double>(t1 - t0).count() / frames;
+	std::cout << name << ": " << ret * 1e6 << " us/frame\n";
+	return ret;
+}
+
+//Returns false if a constant input didn't come out unchanged, which the
+//resampler guarantees.
+bool benchmark_resampler(unsigned frames){
+	const unsigned dst_frequency = 48000;
+	const auto frame_length = AudioBufferOptions().frame_length;
+	std::vector<StereoSampleFinal> src(frame_length), dst;
+	dst.reserve(AudioFrame::max_length * 2);
+
+	Resampler resampler(synthesis_frequency, dst_frequency);
+	for (unsigned i = 0; i < frame_length; i++)
+		src[i].left = src[i].right = (std::int16_t)(i % 100 < 50 ? 4000 : -4000);
+	auto t0 = std::chrono::high_resolution_clock::now();
+	for (unsigned frame = 0; frame < frames; frame++){
+		dst.clear();
+		resampler.process(src.data(), frame_length, dst);
+	}
+	auto t1 = std::chrono::high_resolution_clock::now();
+	std::cout << "Resampler: " << std::chrono::duration<double>(t1 - t0).count() / frames * 1e6 << " us/frame\n";
+
+	Resampler constant(synthesis_frequency, dst_frequency);
+	for (auto &sample : src)
+		sample.left = sample.right = 1234;
+	dst.clear();
+	for (int i = 0; i < 4; i++)
+		constant.process(src.data(), frame_length, dst);
+	for (auto &sample : dst)
+		if (sample.left != 1234 || sample.right != 1234)
+			return false;
+	return !dst.empty();
+}
+
+int main(int argc, char **argv){
+	unsigned frames = argc > 1 ? (unsigned)atoi(argv[1]) : 20000;
+	if (!frames){
+		std::cerr << "Usage: audio_benchmark [frames]\n";
+		return 2;
+	}
+	std::int64_t checksum_virtual, checksum_static;
+	auto time_virtual = benchmark<ChannelPipeline<VirtualChannel, VirtualChannel, VirtualChannel, VirtualChannel>>("Virtual", frames, checksum_virtual);
+	auto time_static = benchmark<ChannelPipeline<
+		StaticChannel<Square1Generator>,
+		StaticChannel<Square2Generator>,
+		StaticChannel<VoluntaryWaveGenerator>,
+		StaticChannel<NoiseGenerator>
+	>>("Static", frames, checksum_static);
+	std::cout << "Speedup: " << time_virtual / time_static << "x\n";
+	if (checksum_virtual != checksum_static){
+		std::cerr << "The pipelines produced different output.\n";
+		return 1;
+	}
+	if (!benchmark_resampler(frames)){
+		std::cerr << "The resampler altered a constant signal.\n";
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,89 @@
+//Compares two frame hash streams written by cppred --frame-hashes and reports
+//the first frame where they differ.
+//Exit status: 0 if the streams are identical, 1 if they differ, 2 on error.
+
+#include "../../common/FrameHashStream.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+class FrameHashReader{
+	std::ifstream file;
+	std::string path;
+	std::vector<std::uint8_t> buffer;
+	size_t buffer_size = 0;
+	size_t buffer_position = 0;
+public:
+	std::uint32_t width;
+	std::uint32_t height;
+
+	FrameHashReader(const std::string &path): file(path, std::ios::binary), path(path){
+		if (!this->file)
+			throw std::runtime_error("Can't open " + path);
+		std::uint8_t header[frame_hash_stream_header_size];
+		if (!this->file.read((char *)header, sizeof(header)) || memcmp(header, frame_hash_stream_magic, sizeof(frame_hash_stream_magic)))
+			throw std::runtime_error(path + " is not a frame hash stream");
+		this->width = (std::uint32_t)read_le(header + 8, 4);
+		this->height = (std::uint32_t)read_le(header + 12, 4);
+		this->buffer.resize(1 << 16);
+	}
+	const std::string &get_path() const{
+		return this->path;
+	}
+	bool next(std::uint64_t &hash){
+		if (this->buffer_position == this->buffer_size){
+			this->file.read((char *)&this->buffer[0], this->buffer.size());
+			this->buffer_size = (size_t)this->file.gcount() / 8 * 8;
+			this->buffer_position = 0;
+			if (!this->buffer_size)
+				return false;
+		}
+		hash = read_le(&this->buffer[this->buffer_position], 8);
+		this->buffer_position += 8;
+		return true;
+	}
+};
+
+static int compare(FrameHashReader &a, FrameHashReader &b){
+	if (a.width != b.width || a.height != b.height){
+		std::cout << "Frame sizes differ: " << a.width << 'x' << a.height << " vs. " << b.width << 'x' << b.height << std::endl;
+		return 1;
+	}
+	for (std::uint64_t frame = 0;; frame++){
+		std::uint64_t hash_a, hash_b;
+		bool has_a = a.next(hash_a);
+		bool has_b = b.next(hash_b);
+		if (!has_a && !has_b){
+			std::cout << "Streams are identical (" << frame << " frames)." << std::endl;
+			return 0;
+		}
+		if (!has_a || !has_b){
+			auto &shorter = has_a ? b : a;
+			std::cout << shorter.get_path() << " ends at frame " << frame << "; all earlier frames are identical." << std::endl;
+			return 1;
+		}
+		if (hash_a != hash_b){
+			std::cout << "First divergent frame: " << frame << std::endl;
+			return 1;
+		}
+	}
+}
+
+int main(int argc, char **argv){
+	if (argc < 3){
+		std::cerr << "Usage: " << argv[0] << " <stream A> <stream B>\n";
+		return 2;
+	}
+	try{
+		FrameHashReader a(argv[1]);
+		FrameHashReader b(argv[2]);
+		return compare(a, b);
+	}catch (std::exception &e){
+		std::cerr << e.what() << std::endl;
+		return 2;
+	}
+}